@@ -5,11 +5,36 @@
 
 static ScaleHMM* hmm; // declare as static outside the function because we only need one and this enables memory-cleanup on R_CheckUserInterrupt()
 static double** multiD;
+static double* bivariateD; // densities of the bivariate HMM, allocated in C because they are recomputed in every iteration
+
+// =====================================================================================
+// Emission density of one state: 1 delta, 2 geometric, 3 negative binomial, 4 binomial, 5 zero-inflated negative binomial
+// =====================================================================================
+static Density* new_density(int* O, int T, int distr_type, double size, double prob, double w)
+{
+	if (distr_type == 1)
+	{
+		return new ZeroInflation(O, T);
+	}
+	else if (distr_type == 2)
+	{
+		return new Geometric(O, T, prob);
+	}
+	else if (distr_type == 4)
+	{
+		return new Binomial(O, T, size, prob);
+	}
+	else if (distr_type == 5)
+	{
+		return new ZeroInflatedNegativeBinomial(O, T, w, size, prob);
+	}
+	return new NegativeBinomial(O, T, size, prob);
+}
 
 // ===================================================================================================================================================
 // This function takes parameters from R, creates a univariate HMM object, creates the distributions, runs the EM and returns the result to R.
 // ===================================================================================================================================================
-void univariate_hmm(int* O, int* T, int* N, int* state_labels, double* size, double* prob, int* maxiter, int* maxtime, double* eps, double* maxPosterior, int* states, double* A, double* proba, double* loglik, double* weights, int* distr_type, double* initial_size, double* initial_prob, double* initial_A, double* initial_proba, bool* use_initial_params, int* num_threads, int* error, int* read_cutoff, int* algorithm, int* verbosity)
+void univariate_hmm(int* O, int* T, int* N, int* state_labels, double* size, double* prob, int* maxiter, int* maxtime, double* eps, double* maxPosterior, double* margin, double* entropy, int* states, double* A, double* proba, double* loglik, double* weights, int* distr_type, double* initial_size, double* initial_prob, double* initial_A, double* initial_proba, bool* use_initial_params, int* num_threads, int* error, int* read_cutoff, int* algorithm, int* verbosity, char** checkpoint_file, int* checkpoint_interval, char** parameter_store, int* store_mode, int* chunk_lengths, int* num_chunks, int* segment_lengths, int* num_segments, double* w, double* initial_w, int* hmm_engine)
 {
 
 	// Define logging level
@@ -50,18 +75,22 @@ void univariate_hmm(int* O, int* T, int* N, int* state_labels, double* size, dou
 		//FILE_LOG(logDEBUG3) << "O["<<t<<"] = " << O[t];
 	}
 
+	// Seed the initial parameters with the fits of similar samples
+	if ((strlen(*parameter_store) > 0) && (*store_mode & 1))
+	{
+		ParameterStore store(*parameter_store, 25);
+		int num_fits = store.seed(*N, distr_type, initial_size, initial_prob, initial_A, initial_proba);
+		if (num_fits > 0)
+		{
+			*use_initial_params = true;
+			//FILE_LOG(logINFO) << "initial parameters from " << num_fits << " fits in parameter store";
+			if (*verbosity>=1) Rprintf("initial parameters from %d fits in parameter store\n", num_fits);
+		}
+	}
+
 	// Flush if (*verbosity>=1) Rprintf statements to console
 	R_FlushConsole();
 
-	// Create the HMM
-	//FILE_LOG(logDEBUG1) << "Creating a univariate HMM";
-	hmm = new ScaleHMM(*T, *N);
-// 	LogHMM* hmm = new LogHMM(*T, *N);
-	hmm->set_cutoff(*read_cutoff);
-	// Initialize the transition probabilities and proba
-	hmm->initialize_transition_probs(initial_A, *use_initial_params);
-	hmm->initialize_proba(initial_proba, *use_initial_params);
-    
 	// Calculate mean and variance of data
 	double mean = 0, variance = 0;
 	for(int t=0; t<*T; t++)
@@ -76,65 +105,122 @@ void univariate_hmm(int* O, int* T, int* N, int* state_labels, double* size, dou
 	variance = variance / *T;
 	//FILE_LOG(logINFO) << "data mean = " << mean << ", data variance = " << variance;		
 	if (*verbosity>=1) Rprintf("data mean = %g, data variance = %g\n", mean, variance);		
-	
-	// Create the emission densities and initialize
-	for (int i_state=0; i_state<*N; i_state++)
+
+	// The engine of the forward-backward recursions (hmm_engine: 0 auto, 1 scaled, 2 log space, 3 scaled in single precision), log space is only available over bins
+	// With hmm_engine == 0 the scaled engine is used and the fit is repeated in log space if the scaled probabilities underflow
+	bool log_engine = (*num_segments == 0);
+	whichengine engine = SCALED_DOUBLE;
+	if ((*hmm_engine == 2) && log_engine) engine = LOG_SPACE;
+	else if (*hmm_engine == 3) engine = SCALED_FLOAT;
+	int maxiter0 = *maxiter, maxtime0 = *maxtime;
+	double eps_converged = *eps;
+
+	while (true)
 	{
-		if (distr_type[i_state] == 1)
+		// Create the HMM
+		//FILE_LOG(logDEBUG1) << "Creating a univariate HMM";
+		if (*algorithm == 4)
 		{
-			//FILE_LOG(logDEBUG1) << "Using delta distribution for state " << i_state;
-			ZeroInflation *d = new ZeroInflation(O, *T); // delete is done inside ~ScaleHMM()
-			hmm->densityFunctions.push_back(d);
+			// The online EM only holds one chunk in memory at a time
+			hmm = new ScaleHMM(intMax(chunk_lengths, *num_chunks), *N);
 		}
-		else if (distr_type[i_state] == 2)
+		else if (*num_segments > 0)
 		{
-			//FILE_LOG(logDEBUG1) << "Using geometric distribution for state " << i_state;
-			Geometric *d = new Geometric(O, *T, initial_prob[i_state]); // delete is done inside ~ScaleHMM()
-			hmm->densityFunctions.push_back(d);
+			// One time point per segment
+			hmm = new ScaleHMM(*num_segments, *N);
 		}
-		else if (distr_type[i_state] == 3)
+		else
 		{
-			//FILE_LOG(logDEBUG1) << "Using negative binomial for state " << i_state;
-			NegativeBinomial *d = new NegativeBinomial(O, *T, initial_size[i_state], initial_prob[i_state]); // delete is done inside ~ScaleHMM()
-			hmm->densityFunctions.push_back(d);
+			hmm = new ScaleHMM(*T, *N);
 		}
-		else if (distr_type[i_state] == 4)
+		hmm->set_engine(engine);
+		hmm->set_cutoff(*read_cutoff);
+		hmm->set_num_threads(*num_threads); // only for the parallel loops of this HMM, the process-wide number of threads is left alone
+		// Initialize the transition probabilities and proba
+		hmm->initialize_transition_probs(initial_A, *use_initial_params);
+		hmm->initialize_proba(initial_proba, *use_initial_params);
+
+		// Create the emission densities and initialize
+		for (int i_state=0; i_state<*N; i_state++)
 		{
-			//FILE_LOG(logDEBUG1) << "Using binomial for state " << i_state;
-			NegativeBinomial *d = new NegativeBinomial(O, *T, initial_size[i_state], initial_prob[i_state]); // delete is done inside ~ScaleHMM()
-			hmm->densityFunctions.push_back(d);
+			//FILE_LOG(logDEBUG1) << "Using distribution " << distr_type[i_state] << " for state " << i_state;
+			hmm->densityFunctions.push_back(new_density(O, *T, distr_type[i_state], initial_size[i_state], initial_prob[i_state], initial_w[i_state])); // delete is done inside ~ScaleHMM()
 		}
-		else
+
+		// The HMM needs the observations to compute the densities of all states in one pass
+		if ((*algorithm != 4) && (*num_segments == 0))
 		{
-			//FILE_LOG(logWARNING) << "Density not specified, using default negative binomial for state " << i_state;
-			NegativeBinomial *d = new NegativeBinomial(O, *T, initial_size[i_state], initial_prob[i_state]);
-			hmm->densityFunctions.push_back(d);
+			hmm->set_observations(O, *T);
 		}
-	}
 
-	// Flush if (*verbosity>=1) Rprintf statements to console
-	R_FlushConsole();
+		// Run the HMM over segments instead of bins
+		unsigned int fingerprint = hashIntArray(O, *T);
+		if (*num_segments > 0)
+		{
+			//FILE_LOG(logINFO) << "number of segments = " << *num_segments;
+			if (*verbosity>=1) Rprintf("number of segments = %d\n", *num_segments);
+			hmm->set_segments(O, segment_lengths, *num_segments);
+			fingerprint ^= hashIntArray(segment_lengths, *num_segments);
+		}
 
-	// Do the EM to estimate the parameters
-	try
-	{
-		if (*algorithm == 1)
+		// Continue from and write checkpoints during the EM
+		if (strlen(*checkpoint_file) > 0)
 		{
-			hmm->baumWelch();
+			//FILE_LOG(logINFO) << "checkpoint file = " << *checkpoint_file;
+			if (*verbosity>=1) Rprintf("checkpoint file = %s\n", *checkpoint_file);
+			hmm->set_checkpoint(*checkpoint_file, *checkpoint_interval, fingerprint);
 		}
-		else if (*algorithm == 3)
+
+		// Flush if (*verbosity>=1) Rprintf statements to console
+		R_FlushConsole();
+
+		// Do the EM to estimate the parameters
+		try
 		{
-			//FILE_LOG(logDEBUG1) << "Starting EM estimation";
-			hmm->EM(maxiter, maxtime, eps);
-			//FILE_LOG(logDEBUG1) << "Finished with EM estimation";
+			if (*algorithm == 1)
+			{
+				hmm->baumWelch();
+			}
+			else if (*algorithm == 3)
+			{
+				//FILE_LOG(logDEBUG1) << "Starting EM estimation";
+				hmm->EM(maxiter, maxtime, eps);
+				//FILE_LOG(logDEBUG1) << "Finished with EM estimation";
+			}
+			else if (*algorithm == 4)
+			{
+				//FILE_LOG(logDEBUG1) << "Starting online EM estimation over " << *num_chunks << " chunks";
+				if (*verbosity>=1) Rprintf("number of chunks = %d\n", *num_chunks);
+				hmm->onlineEM(O, chunk_lengths, *num_chunks, 0.6, maxiter, maxtime, eps);
+				//FILE_LOG(logDEBUG1) << "Finished with online EM estimation";
+			}
 		}
-	}
-	catch (std::exception& e)
-	{
-		//FILE_LOG(logERROR) << "Error in EM/baumWelch: " << e.what();
-		if (*verbosity>=1) Rprintf("Error in EM/baumWelch: %s\n", e.what());
-		if (strcmp(e.what(),"nan detected")==0) { *error = 1; }
-		else { *error = 2; }
+		catch (std::exception& e)
+		{
+			//FILE_LOG(logERROR) << "Error in EM/baumWelch: " << e.what();
+			if (*verbosity>=1) Rprintf("Error in EM/baumWelch: %s\n", e.what());
+			if (strcmp(e.what(),"nan detected")==0) { *error = 1; }
+			else { *error = 2; }
+		}
+
+		// Blocks of bins whose scaled probabilities underflow are already recomputed in log space. A nan is left only if a bin has probability zero
+		// in all states in double precision, e.g. an outlier that only one state can explain and whose forward probability at the previous bin is zero.
+		// Such a fit has failed, and it is repeated once in log space, where the densities of the outlier do not underflow.
+		if (log_engine && (*hmm_engine == 0) && (engine != LOG_SPACE) && (*error == 1))
+		{
+			//FILE_LOG(logINFO) << "nan in scaled probabilities, refitting in log space";
+			if (*verbosity>=1) Rprintf("nan in scaled probabilities, refitting in log space\n");
+			delete hmm;
+			hmm = NULL;
+			*use_initial_params = true; // start from the same parameters, initial_A and initial_proba hold the defaults if they were not given
+			*maxiter = maxiter0;
+			*maxtime = maxtime0;
+			*eps = eps_converged;
+			*error = 0;
+			engine = LOG_SPACE;
+			continue;
+		}
+		break;
 	}
 
 	// // Compute the posteriors and save results directly to the R pointer
@@ -150,17 +236,76 @@ void univariate_hmm(int* O, int* T, int* N, int* state_labels, double* size, dou
 
 	// Compute the states from posteriors
 	//FILE_LOG(logDEBUG1) << "Computing states from posteriors";
-	int ind_max;
-	std::vector<double> posterior_per_t(*N);
-	for (int t=0; t<*T; t++)
+	if (*algorithm == 4)
+	{
+		// Decode chunk by chunk with the final parameters, each chunk is an independent sequence
+		double logP = 0;
+		std::vector<double> sum_posterior(*N, 0.0);
+		int offset = 0;
+		for (int c=0; c<*num_chunks && *error==0; c++)
+		{
+			hmm->set_observations(O + offset, chunk_lengths[c]);
+			try { hmm->baumWelch(); }
+			catch (std::exception& e)
+			{
+				//FILE_LOG(logERROR) << "Error in baumWelch: " << e.what();
+				if (*verbosity>=1) Rprintf("Error in baumWelch: %s\n", e.what());
+				if (strcmp(e.what(),"nan detected")==0) { *error = 1; }
+				else { *error = 2; }
+				break;
+			}
+			hmm->summarize_posteriors(states + offset, maxPosterior + offset, margin + offset, entropy + offset, &sum_posterior[0], NULL);
+			for (int t=offset; t<offset+chunk_lengths[c]; t++)
+			{
+				states[t] = state_labels[states[t]];
+			}
+			logP += hmm->get_logP();
+			offset += chunk_lengths[c];
+		}
+		*loglik = logP;
+		for (int iN=0; iN<*N; iN++)
+		{
+			weights[iN] = sum_posterior[iN] / *T;
+		}
+	}
+	else if (*num_segments > 0)
+	{
+		// All bins of a segment get the posteriors of the segment
+		std::vector<double> sum_posterior(*N, 0.0);
+		std::vector<int> segment_states(*num_segments);
+		std::vector<double> segment_maxPosterior(*num_segments), segment_margin(*num_segments), segment_entropy(*num_segments);
+		hmm->summarize_posteriors(&segment_states[0], &segment_maxPosterior[0], &segment_margin[0], &segment_entropy[0], &sum_posterior[0], segment_lengths);
+		int t0 = 0;
+		for (int s=0; s<*num_segments; s++)
+		{
+			for (int t=t0; t<t0+segment_lengths[s]; t++)
+			{
+				states[t] = state_labels[segment_states[s]];
+				maxPosterior[t] = segment_maxPosterior[s];
+				margin[t] = segment_margin[s];
+				entropy[t] = segment_entropy[s];
+			}
+			t0 += segment_lengths[s];
+		}
+		*loglik = hmm->get_logP();
+		for (int iN=0; iN<*N; iN++)
+		{
+			weights[iN] = sum_posterior[iN] / *T;
+		}
+	}
+	else
 	{
+		std::vector<double> sum_posterior(*N, 0.0);
+		hmm->summarize_posteriors(states, maxPosterior, margin, entropy, &sum_posterior[0], NULL);
+		for (int t=0; t<*T; t++)
+		{
+			states[t] = state_labels[states[t]];
+		}
+		*loglik = hmm->get_logP();
 		for (int iN=0; iN<*N; iN++)
 		{
-			posterior_per_t[iN] = hmm->get_posterior(iN, t);
+			weights[iN] = sum_posterior[iN] / *T;
 		}
-		ind_max = std::distance(posterior_per_t.begin(), std::max_element(posterior_per_t.begin(), posterior_per_t.end()));
-		states[t] = state_labels[ind_max];
-		maxPosterior[t] = posterior_per_t[ind_max];
 	}
 
 	//FILE_LOG(logDEBUG1) << "Return parameters";
@@ -201,31 +346,288 @@ void univariate_hmm(int* O, int* T, int* N, int* state_labels, double* size, dou
 			size[i] = d->get_size();
 			prob[i] = d->get_prob();
 		}
+		else if (hmm->densityFunctions[i]->get_name() == ZERO_INFLATED_NEGATIVE_BINOMIAL) 
+		{
+			ZeroInflatedNegativeBinomial* d = (ZeroInflatedNegativeBinomial*)(hmm->densityFunctions[i]);
+			size[i] = d->get_size();
+			prob[i] = d->get_prob();
+			w[i] = d->get_w();
+		}
 	}
-	*loglik = hmm->get_logP();
-	hmm->calc_weights(weights);
-	
 	//FILE_LOG(logDEBUG1) << "Deleting the hmm";
 	delete hmm;
 	hmm = NULL; // assign NULL to defuse the additional delete in on.exit() call
+
+	// Add converged fits to the parameter store
+	if ((strlen(*parameter_store) > 0) && (*store_mode & 2) && ((*algorithm == 3) || (*algorithm == 4)) && (*error == 0) && (fabs(*eps) < eps_converged))
+	{
+		ParameterStore store(*parameter_store, 25);
+		store.record(*N, distr_type, size, prob, A, proba);
+		store.save();
+	}
 }
 
 
-// =====================================================================================================================================================
-// This function takes parameters from R, creates a multivariate HMM object, runs the EM and returns the result to R.
-// =====================================================================================================================================================
-void multivariate_hmm(double* D, int* T, int* N, int *Nmod, int* comb_states, int* maxiter, int* maxtime, double* eps, double* maxPosterior, int* states, double* A, double* proba, double* loglik, double* initial_A, double* initial_proba, bool* use_initial_params, int* num_threads, int* error, int* algorithm, int* verbosity)
+// =======================================================
+// This function make a cleanup if anything was left over
+// =======================================================
+void univariate_cleanup()
 {
+// 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__; // This message will be shown if interrupt happens before start of C-code
+	delete hmm;
+}
 
-	// Define logging level {"ERROR", "WARNING", "INFO", "ITERATION", "DEBUG", "DEBUG1", "DEBUG2", "DEBUG3", "DEBUG4"}
-// 	FILE* pFile = fopen("chromStar.log", "w");
-// 	Output2FILE::Stream() = pFile;
-//  	FILELog::ReportingLevel() = FILELog::FromString("ITERATION");
-//  	FILELog::ReportingLevel() = FILELog::FromString("DEBUG2");
-//  	FILELog::ReportingLevel() = FILELog::FromString("ERROR");
+void multivariate_cleanup()
+{
+	delete hmm;
+	Free(multiD); // only the row pointers into bivariateD
+	Free(bivariateD);
+}
 
-	// Parallelization settings
-// 	omp_set_num_threads(*num_threads);
+
+// =====================================================================================
+// Summary of a matrix [T x N] of posteriors in one pass, the C version of apply(posteriors, 1, which.max) and apply(posteriors, 1, max)
+// =====================================================================================
+void posterior_summary(double* posteriors, int* T, int* N, int* ind_max, double* value_max, int* num_threads)
+{
+	// posteriors is actually a vector, but is intended to originate from a 2D array in R, so each column is contiguous
+	std::vector<double*> columns(*N);
+	for (int iN=0; iN<*N; iN++)
+	{
+		columns[iN] = &posteriors[(size_t)iN * (*T)];
+	}
+	summarizePosteriors(&columns[0], *N, *T, NULL, ind_max, value_max, NULL, NULL, NULL, *num_threads);
+	for (int t=0; t<*T; t++)
+	{
+		ind_max[t] += 1;
+	}
+}
+
+// =====================================================================================
+// Bivariate HMM with the marginals of each strand and state and the copula correlations, see bivariate_hmm() for the layout of the arguments
+// =====================================================================================
+static ScaleHMM* new_bivariate_hmm(int* O, int T, int N, int Nmod, int num_states, int* comb_states, int* distr_type, double* size, double* prob, double* w, double* cor_matrix, double** D, double* initial_A, double* initial_proba, bool use_initial_params)
+{
+	ScaleHMM* bihmm = new ScaleHMM(T, N, Nmod, D);
+	// Initialize the transition probabilities and proba
+	bihmm->initialize_transition_probs(initial_A, use_initial_params);
+	bihmm->initialize_proba(initial_proba, use_initial_params);
+
+	// Create the marginal distributions of each strand and the copula
+	std::vector<int*> multiO(Nmod);
+	for (int i_mod=0; i_mod<Nmod; i_mod++)
+	{
+		multiO[i_mod] = &O[i_mod * T];
+		bihmm->marginals.push_back(std::vector<Density*>());
+		for (int i_state=0; i_state<num_states; i_state++)
+		{
+			int i = i_mod * num_states + i_state;
+			bihmm->marginals[i_mod].push_back(new_density(multiO[i_mod], T, distr_type[i], size[i], prob[i], w[i])); // delete is done inside ~ScaleHMM()
+		}
+	}
+	std::vector<int> comb_states0(Nmod * N);
+	for (int i=0; i<Nmod * N; i++)
+	{
+		comb_states0[i] = comb_states[i] - 1;
+	}
+	bihmm->set_copula(&multiO[0], &comb_states0[0], cor_matrix);
+	return bihmm;
+}
+
+static void run_bivariate_hmm(ScaleHMM* bihmm, int* maxiter, int* maxtime, double* eps, int* error, int algorithm, int verbosity)
+{
+	try
+	{
+		if (algorithm == 1)
+		{
+			bihmm->baumWelch();
+		}
+		else if (algorithm == 3)
+		{
+			//FILE_LOG(logDEBUG1) << "Starting EM estimation";
+			bihmm->EM(maxiter, maxtime, eps);
+			//FILE_LOG(logDEBUG1) << "Finished with EM estimation";
+		}
+	}
+	catch (std::exception& e)
+	{
+		//FILE_LOG(logERROR) << "Error in EM/baumWelch: " << e.what();
+		if (verbosity>=1) Rprintf("Error in EM/baumWelch: %s\n", e.what());
+		if (strcmp(e.what(),"nan detected")==0) { *error = 1; }
+		else { *error = 2; }
+	}
+}
+
+static void get_bivariate_results(ScaleHMM* bihmm, int T, int N, int Nmod, int num_states, double* maxPosterior, double* margin, double* entropy, int* states, double* A, double* proba, double* loglik, double* size, double* prob, double* w, double* cor_matrix)
+{
+	// Compute the states from posteriors
+	//FILE_LOG(logDEBUG1) << "Computing states from posteriors";
+	bihmm->summarize_posteriors(states, maxPosterior, margin, entropy, NULL, NULL);
+	for (int t=0; t<T; t++)
+	{
+		states[t] += 1;
+	}
+
+	//FILE_LOG(logDEBUG1) << "Return parameters";
+	// also return the estimated transition matrix and the initial probs
+	for (int i=0; i<N; i++)
+	{
+		proba[i] = bihmm->get_proba(i);
+		for (int j=0; j<N; j++)
+		{
+				A[i * N + j] = bihmm->get_A(j,i);
+		}
+	}
+	*loglik = bihmm->get_logP();
+
+	// copy the estimated marginal params and correlations
+	for (int i_mod=0; i_mod<Nmod; i_mod++)
+	{
+		for (int i_state=0; i_state<num_states; i_state++)
+		{
+			int i = i_mod * num_states + i_state;
+			Density* d = bihmm->marginals[i_mod][i_state];
+			if (d->get_name() == NEGATIVE_BINOMIAL)
+			{
+				size[i] = ((NegativeBinomial*) d)->get_size();
+				prob[i] = ((NegativeBinomial*) d)->get_prob();
+			}
+			else if (d->get_name() == GEOMETRIC)
+			{
+				prob[i] = ((Geometric*) d)->get_prob();
+			}
+			else if (d->get_name() == BINOMIAL)
+			{
+				size[i] = ((Binomial*) d)->get_size();
+				prob[i] = ((Binomial*) d)->get_prob();
+			}
+			else if (d->get_name() == ZERO_INFLATED_NEGATIVE_BINOMIAL)
+			{
+				size[i] = ((ZeroInflatedNegativeBinomial*) d)->get_size();
+				prob[i] = ((ZeroInflatedNegativeBinomial*) d)->get_prob();
+				w[i] = ((ZeroInflatedNegativeBinomial*) d)->get_w();
+			}
+		}
+	}
+	bihmm->get_cor_matrix(cor_matrix);
+}
+
+// =====================================================================================
+// z-values of the bins for the copula in the bivariate HMM: qnorm(P(X<=count)) under the
+// distribution of each strand and state, looked up from a table over the counts
+// The copula functions below are called by the tests, the bivariate HMM uses the same
+// tables (tabulate_marginal()), co-moments and densities in ScaleHMM::update_copula()
+// =====================================================================================
+void copula_zvalues(int* counts, int* num_bins, int* num_models, int* num_states, int* distr_type, double* size, double* prob, double* w, double* z_per_bin)
+{
+	// counts is a matrix [num_bins x num_models], the parameters are matrices [num_states x num_models] and z_per_bin is an array [num_bins x num_models x num_states]
+	for (int i_mod=0; i_mod<*num_models; i_mod++)
+	{
+		int* O = &counts[i_mod * (*num_bins)];
+		int max_obs = intMax(O, *num_bins);
+		std::vector<double> z_per_count(max_obs+1);
+		for (int i_state=0; i_state<*num_states; i_state++)
+		{
+			int i = i_mod * (*num_states) + i_state;
+			Density* d = new_density(O, *num_bins, distr_type[i], size[i], prob[i], w[i]);
+			MVCopulaApproximation::calc_zvalues_per_read(d, &z_per_count[0], max_obs);
+			delete d;
+			double* z = &z_per_bin[(i_state * (*num_models) + i_mod) * (*num_bins)];
+			for (int t=0; t<*num_bins; t++)
+			{
+				z[t] = z_per_count[O[t]];
+			}
+		}
+	}
+}
+
+// =====================================================================================
+// Correlation matrices of the z-values of the bins in each combined state for the copula
+// =====================================================================================
+void copula_correlations(double* z_per_bin, int* num_bins, int* num_models, int* num_comb_states, int* comb_states, int* comb_state_per_bin, double* cor_matrix, double* cor_matrix_inv, double* determinant)
+{
+	// z_per_bin is an array [num_bins x num_models x num_states], comb_states a matrix [num_models x num_comb_states] of the (1-based) univariate state of each strand, comb_state_per_bin holds the (1-based) combined state of each bin or 0
+	// The means and co-moments of each combined state are updated bin by bin (Welford), so that one pass over the bins suffices
+	int M = *num_models;
+	std::vector<double> n(*num_comb_states, 0.0), mean(*num_comb_states * M, 0.0), comoment(*num_comb_states * M * M, 0.0), z(M);
+	for (int t=0; t<*num_bins; t++)
+	{
+		int iN = comb_state_per_bin[t] - 1;
+		if (iN < 0) continue;
+		for (int i=0; i<M; i++)
+		{
+			z[i] = z_per_bin[(*num_bins) * ((comb_states[iN * M + i] - 1) * M + i) + t];
+		}
+		updateComoments(&z[0], 1.0, M, &n[iN], &mean[iN * M], &comoment[iN * M * M]);
+	}
+	// As in the former R code, states with a constant z-value (or less than two bins, which have zero co-moments) or a singular correlation matrix get the identity
+	for (int iN=0; iN<*num_comb_states; iN++)
+	{
+		correlationInverse(&comoment[iN * M * M], M, &cor_matrix[iN * M * M], &cor_matrix_inv[iN * M * M], &determinant[iN]);
+	}
+}
+
+// =====================================================================================
+// Densities of the combined states in the bivariate HMM with the Gaussian copula
+// =====================================================================================
+void copula_densities(int* counts, int* num_bins, int* num_models, int* num_states, int* distr_type, double* size, double* prob, double* w, int* num_comb_states, int* comb_states, double* cor_matrix_inv, double* determinant, int* num_threads, double* densities)
+{
+	// comb_states is a matrix [num_models x num_comb_states] of the (1-based) univariate state of each strand, cor_matrix_inv an array [num_models x num_models x num_comb_states] and densities a matrix [num_bins x num_comb_states]
+	std::vector<int*> multiO(*num_models);
+	for (int i_mod=0; i_mod<*num_models; i_mod++)
+	{
+		multiO[i_mod] = &counts[i_mod * (*num_bins)];
+	}
+	// The densities and z-values of each strand and univariate state are tabulated once and shared by all combined states
+	std::vector< std::vector<double> > dens_per_read((*num_models) * (*num_states)), z_per_read((*num_models) * (*num_states));
+	for (int i_mod=0; i_mod<*num_models; i_mod++)
+	{
+		int max_obs = intMax(multiO[i_mod], *num_bins);
+		for (int i_state=0; i_state<*num_states; i_state++)
+		{
+			int i = i_mod * (*num_states) + i_state;
+			Density* d = new_density(multiO[i_mod], *num_bins, distr_type[i], size[i], prob[i], w[i]);
+			MVCopulaApproximation::tabulate_marginal(d, max_obs, dens_per_read[i], z_per_read[i]);
+			delete d;
+		}
+	}
+	std::vector<MVCopulaApproximation*> copulas(*num_comb_states);
+	for (int iN=0; iN<*num_comb_states; iN++)
+	{
+		std::vector<const double*> dens_tables(*num_models), z_tables(*num_models);
+		for (int i_mod=0; i_mod<*num_models; i_mod++)
+		{
+			int i = i_mod * (*num_states) + comb_states[iN * (*num_models) + i_mod] - 1;
+			dens_tables[i_mod] = &dens_per_read[i][0];
+			z_tables[i_mod] = &z_per_read[i][0];
+		}
+		copulas[iN] = new MVCopulaApproximation(&multiO[0], *num_bins, dens_tables, z_tables, &cor_matrix_inv[iN * (*num_models) * (*num_models)], determinant[iN]);
+	}
+	// Every task computes one state over one block of bins
+	const int block = 4096;
+	int num_blocks = (*num_bins + block - 1) / block;
+	#pragma omp parallel for schedule(dynamic) num_threads(*num_threads)
+	for (int task=0; task<(*num_comb_states) * num_blocks; task++)
+	{
+		int iN = task / num_blocks;
+		int tstart = (task % num_blocks) * block;
+		int tend = std::min(tstart + block, *num_bins);
+		copulas[iN]->calc_densities(&densities[iN * (*num_bins)], tstart, tend);
+	}
+	for (int iN=0; iN<*num_comb_states; iN++)
+	{
+		delete copulas[iN];
+	}
+}
+
+// =====================================================================================================================================================
+// This function takes counts and initial marginals from R, creates a bivariate HMM with copula densities, runs the EM and returns the result to R.
+// The marginals and correlations of the copula are estimated together with the transition probabilities.
+// =====================================================================================================================================================
+void bivariate_hmm(int* O, int* T, int* N, int* Nmod, int* num_states, int* comb_states, int* distr_type, double* size, double* prob, double* w, double* cor_matrix, int* maxiter, int* maxtime, double* eps, double* maxPosterior, double* margin, double* entropy, int* states, double* A, double* proba, double* loglik, double* initial_A, double* initial_proba, bool* use_initial_params, int* num_threads, int* error, int* algorithm, int* verbosity)
+{
+	// O is a matrix [T x Nmod], the marginal parameters size, prob, w are matrices [num_states x Nmod] with the initial values on input and the estimates on output,
+	// comb_states is a matrix [Nmod x N] of the (1-based) univariate state of each strand and cor_matrix an array [Nmod x Nmod x N] with the initial and estimated correlations
 
 	// Print some information
 	//FILE_LOG(logINFO) << "number of states = " << *N;
@@ -256,134 +658,364 @@ void multivariate_hmm(double* D, int* T, int* N, int *Nmod, int* comb_states, in
 	// Flush if (*verbosity>=1) Rprintf statements to console
 	R_FlushConsole();
 
-	// Recode the densities vector to matrix representation
-// 	clock_t clocktime = clock(), dtime;
-	multiD = CallocDoubleMatrix(*N, *T);
+	// Matrix view [N x T] of the densities, which are filled by the HMM
+	bivariateD = (double*) Calloc((*N) * (*T), double);
+	multiD = (double**) Calloc(*N, double*);
 	for (int iN=0; iN<*N; iN++)
 	{
-		for (int t=0; t<*T; t++)
-		{
-			multiD[iN][t] = D[iN*(*T)+t];
-		}
+		multiD[iN] = &bivariateD[iN*(*T)];
 	}
-// 	dtime = clock() - clocktime;
-// 	//FILE_LOG(logDEBUG1) << "recoding densities vector to matrix representation: " << dtime << " clicks";
 
 	// Create the HMM
-	//FILE_LOG(logDEBUG1) << "Creating the multivariate HMM";
-	hmm = new ScaleHMM(*T, *N, *Nmod, multiD);
-	// Initialize the transition probabilities and proba
-	hmm->initialize_transition_probs(initial_A, *use_initial_params);
-	hmm->initialize_proba(initial_proba, *use_initial_params);
-	
-	// Print logproba and A
-// 	for (int iN=0; iN<*N; iN++)
-// 	{
-// 		//FILE_LOG(logDEBUG) << "proba["<<iN<<"] = " <<exp(hmm->logproba[iN]);
-// 		for (int jN=0; jN<*N; jN++)
-// 		{
-// 			//FILE_LOG(logDEBUG) << "A["<<iN<<"]["<<jN<<"] = " << hmm->A[iN][jN];
-// 		}
-// 	}
+	//FILE_LOG(logDEBUG1) << "Creating the bivariate HMM";
+	hmm = new_bivariate_hmm(O, *T, *N, *Nmod, *num_states, comb_states, distr_type, size, prob, w, cor_matrix, multiD, initial_A, initial_proba, *use_initial_params);
 
 	// Do the EM to estimate the parameters
-	try
+	run_bivariate_hmm(hmm, maxiter, maxtime, eps, error, *algorithm, *verbosity);
+
+	// Compute the states from posteriors and return the parameters
+	get_bivariate_results(hmm, *T, *N, *Nmod, *num_states, maxPosterior, margin, entropy, states, A, proba, loglik, size, prob, w, cor_matrix);
+
+	//FILE_LOG(logDEBUG1) << "Deleting the hmm";
+	delete hmm;
+	hmm = NULL; // assign NULL to defuse the additional delete in on.exit() call
+	Free(multiD);
+	Free(bivariateD);
+}
+
+// ==============================================================================================// Emission densities of the univariate HMM with the given parameters, computed by the HMM in one pass
+// over the observations (fused) or by the density function of every state, for the tests
+// =====================================================================================================
+void univariate_densities(int* O, int* T, int* N, int* distr_type, double* size, double* prob, bool* fused, double* densities)
+{
+	ScaleHMM* hmm = new ScaleHMM(*T, *N);
+	for (int i_state=0; i_state<*N; i_state++)
 	{
-		if (*algorithm == 1)
+		if (distr_type[i_state] == 1)
 		{
-			hmm->baumWelch();
+			hmm->densityFunctions.push_back(new ZeroInflation(O, *T));
 		}
-		else if (*algorithm == 3)
+		else if (distr_type[i_state] == 2)
 		{
-			//FILE_LOG(logDEBUG1) << "Starting EM estimation";
-			hmm->EM(maxiter, maxtime, eps);
-			//FILE_LOG(logDEBUG1) << "Finished with EM estimation";
+			hmm->densityFunctions.push_back(new Geometric(O, *T, prob[i_state]));
+		}
+		else
+		{
+			hmm->densityFunctions.push_back(new NegativeBinomial(O, *T, size[i_state], prob[i_state]));
 		}
 	}
-	catch (std::exception& e)
+	hmm->set_observations(O, *T);
+	double** dens = CallocDoubleMatrix(*N, *T);
+	hmm->get_densities(dens, *fused);
+	for (int iN=0; iN<*N; iN++)
 	{
-		//FILE_LOG(logERROR) << "Error in EM/baumWelch: " << e.what();
-		if (*verbosity>=1) Rprintf("Error in EM/baumWelch: %s\n", e.what());
-		if (strcmp(e.what(),"nan detected")==0) { *error = 1; }
-		else { *error = 2; }
+		for (int t=0; t<*T; t++)
+		{
+			densities[iN * (*T) + t] = dens[iN][t];
+		}
 	}
-	
-// 	// Compute the posteriors and save results directly to the R pointer
-// 	//FILE_LOG(logDEBUG1) << "Recode posteriors into column representation";
-// 	for (int iN=0; iN<*N; iN++)
-// 	{
-// 		for (int t=0; t<*T; t++)
-// 		{
-// 			posteriors[t + iN * (*T)] = hmm->get_posterior(iN, t);
-// 		}
-// 	}
+	FreeDoubleMatrix(dens, *N);
+	delete hmm;
+}
 
-	// Compute the states from posteriors
-	//FILE_LOG(logDEBUG1) << "Computing states from posteriors";
-	int ind_max;
-	std::vector<double> posterior_per_t(*N);
-	for (int t=0; t<*T; t++)
+
+// =====================================================================================================================================================
+// This function fits the bivariate HMMs of several Strand-seq cells concurrently. All cells share the combined states and the initial transition
+// probabilities, every thread fits one cell at a time with the EM and writes its results into the slots of that cell.
+// =====================================================================================================================================================
+void bivariate_hmms(int* O, int* num_cells, int* T, int* N, int* Nmod, int* num_states, int* comb_states, int* distr_type, double* size, double* prob, double* w, double* cor_matrix, int* maxiter, int* maxtime, double* eps, double* maxPosterior, int* states, double* A, double* proba, double* loglik, double* initial_A, double* initial_proba, bool* use_initial_params, int* num_threads, int* error, int* verbosity)
+{
+	// T is a vector [num_cells] of the number of bins of each cell, O holds the matrix [T x Nmod] of each cell one after another and so do maxPosterior and states with [T] values per cell,
+	// size, prob, w are arrays [num_states x Nmod x num_cells], cor_matrix an array [Nmod x Nmod x N x num_cells], A an array [N x N x num_cells], proba a matrix [N x num_cells],
+	// maxiter, maxtime, eps, loglik and error are vectors [num_cells]. comb_states, distr_type, initial_A and initial_proba are the same for all cells as in bivariate_hmm().
+
+	// Print some information
+	//FILE_LOG(logINFO) << "number of cells = " << *num_cells;
+	if (*verbosity>=1) Rprintf("number of cells = %d\n", *num_cells);
+	//FILE_LOG(logINFO) << "number of states = " << *N;
+	if (*verbosity>=1) Rprintf("number of states = %d\n", *N);
+	//FILE_LOG(logINFO) << "number of threads = " << *num_threads;
+	if (*verbosity>=1) Rprintf("number of threads = %d\n", *num_threads);
+
+	// Flush if (*verbosity>=1) Rprintf statements to console
+	R_FlushConsole();
+
+	// The initial transition probabilities are set once here, so that the threads only read them
+	if (!*use_initial_params)
 	{
-		for (int iN=0; iN<*N; iN++)
+		ScaleHMM::default_transition_probs(initial_A, *N);
+		ScaleHMM::default_proba(initial_proba, *N);
+	}
+
+	// Offsets of the cells into the bins
+	std::vector<long> offset(*num_cells + 1, 0);
+	for (int c=0; c<*num_cells; c++)
+	{
+		offset[c+1] = offset[c] + T[c];
+	}
+	int num_params = (*num_states) * (*Nmod);
+	int num_cor = (*Nmod) * (*Nmod) * (*N);
+
+	// Cells with many bins first, so that the last threads do not wait for a large cell
+	std::vector<int> cells(*num_cells);
+	for (int c=0; c<*num_cells; c++)
+	{
+		cells[c] = c;
+	}
+	std::stable_sort(cells.begin(), cells.end(), [T](int a, int b) { return T[a] > T[b]; });
+
+	// R must not be called from the threads, so the HMMs of the cells are quiet, allocate without R and R checks for interrupts between chunks of cells
+	int chunk_size = 4 * (*num_threads);
+	for (int start=0; start<*num_cells; start+=chunk_size)
+	{
+		int end = std::min(start + chunk_size, *num_cells);
+		#pragma omp parallel for schedule(dynamic) num_threads(*num_threads)
+		for (int i=start; i<end; i++)
 		{
-			posterior_per_t[iN] = hmm->get_posterior(iN, t);
+			int c = cells[i];
+			ScaleHMM* cellhmm = NULL;
+			try
+			{
+				// Matrix view [N x T] of the densities of this cell
+				std::vector<double> cellD((long)(*N) * T[c]);
+				std::vector<double*> cellD_rows(*N);
+				for (int iN=0; iN<*N; iN++)
+				{
+					cellD_rows[iN] = &cellD[(long)iN * T[c]];
+				}
+				cellhmm = new_bivariate_hmm(&O[offset[c] * (*Nmod)], T[c], *N, *Nmod, *num_states, comb_states, distr_type, &size[c * num_params], &prob[c * num_params], &w[c * num_params], &cor_matrix[c * num_cor], &cellD_rows[0], initial_A, initial_proba, true);
+				cellhmm->set_quiet(true);
+				run_bivariate_hmm(cellhmm, &maxiter[c], &maxtime[c], &eps[c], &error[c], 3, 0);
+				get_bivariate_results(cellhmm, T[c], *N, *Nmod, *num_states, &maxPosterior[offset[c]], NULL, NULL, &states[offset[c]], &A[(long)c * (*N) * (*N)], &proba[c * (*N)], &loglik[c], &size[c * num_params], &prob[c * num_params], &w[c * num_params], &cor_matrix[c * num_cor]);
+			}
+			catch (...)
+			{
+				error[c] = 2;
+			}
+			delete cellhmm;
 		}
-		ind_max = std::distance(posterior_per_t.begin(), std::max_element(posterior_per_t.begin(), posterior_per_t.end()));
-		states[t] = comb_states[ind_max];
-		maxPosterior[t] = posterior_per_t[ind_max];
+		R_CheckUserInterrupt();
 	}
-	
-	//FILE_LOG(logDEBUG1) << "Return parameters";
-	// also return the estimated transition matrix and the initial probs
-	for (int i=0; i<*N; i++)
+}
+
+// ===================================================================================================================================================
+// .Call interface to univariate_hmm() and bivariate_hmm(). The arguments are taken from a named list and used in place,
+// only the results and the parameters that the HMM overwrites are allocated, so that the counts are never duplicated.
+// ===================================================================================================================================================
+static SEXP get_param(SEXP params, const char* name)
+{
+	SEXP names = Rf_getAttrib(params, R_NamesSymbol);
+	if ((TYPEOF(params) != VECSXP) || Rf_isNull(names)) Rf_error("the parameters must be a named list");
+	for (R_xlen_t i=0; i<XLENGTH(params); i++)
 	{
-		proba[i] = hmm->get_proba(i);
-		for (int j=0; j<*N; j++)
+		if (strcmp(CHAR(STRING_ELT(names, i)), name) == 0)
 		{
-				A[i * (*N) + j] = hmm->get_A(j,i);
+			return VECTOR_ELT(params, i);
 		}
 	}
-	*loglik = hmm->get_logP();
+	Rf_error("parameter '%s' is missing", name);
+	return R_NilValue;
+}
 
-	//FILE_LOG(logDEBUG1) << "Deleting the hmm";
-	delete hmm;
-	hmm = NULL; // assign NULL to defuse the additional delete in on.exit() call
-// 	FreeDoubleMatrix(multiD, *N);
+static int* int_param(SEXP params, const char* name, R_xlen_t length)
+{
+	SEXP x = get_param(params, name);
+	if ((TYPEOF(x) != INTSXP) || (XLENGTH(x) != length)) Rf_error("parameter '%s' must be an integer vector of length %ld", name, (long) length);
+	return INTEGER(x);
 }
 
+static double* real_param(SEXP params, const char* name, R_xlen_t length)
+{
+	SEXP x = get_param(params, name);
+	if ((TYPEOF(x) != REALSXP) || (XLENGTH(x) != length)) Rf_error("parameter '%s' must be a double vector of length %ld", name, (long) length);
+	return REAL(x);
+}
 
-// =======================================================
-// This function make a cleanup if anything was left over
-// =======================================================
-void univariate_cleanup()
+static bool logical_param(SEXP params, const char* name)
 {
-// 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__; // This message will be shown if interrupt happens before start of C-code
-	delete hmm;
+	SEXP x = get_param(params, name);
+	if ((TYPEOF(x) != LGLSXP) || (XLENGTH(x) != 1)) Rf_error("parameter '%s' must be TRUE or FALSE", name);
+	return LOGICAL(x)[0] != 0;
 }
 
-void multivariate_cleanup(int* N)
+static char* string_param(SEXP params, const char* name)
 {
-	delete hmm;
-	FreeDoubleMatrix(multiD, *N);
+	SEXP x = get_param(params, name);
+	if ((TYPEOF(x) != STRSXP) || (XLENGTH(x) != 1)) Rf_error("parameter '%s' must be a character string", name);
+	return (char*) CHAR(STRING_ELT(x, 0)); // only read
+}
+
+// Named list of results with the given names, the elements are allocated with int_result() and real_result()
+static SEXP new_results(const char** names, int n)
+{
+	SEXP results = PROTECT(Rf_allocVector(VECSXP, n));
+	SEXP rnames = PROTECT(Rf_allocVector(STRSXP, n));
+	for (int i=0; i<n; i++)
+	{
+		SET_STRING_ELT(rnames, i, Rf_mkChar(names[i]));
+	}
+	Rf_setAttrib(results, R_NamesSymbol, rnames);
+	UNPROTECT(2);
+	return results;
+}
+
+static int* int_result(SEXP results, int i, R_xlen_t length, int value)
+{
+	SET_VECTOR_ELT(results, i, Rf_allocVector(INTSXP, length));
+	int* x = INTEGER(VECTOR_ELT(results, i));
+	for (R_xlen_t j=0; j<length; j++) x[j] = value;
+	return x;
+}
+
+static double* real_result(SEXP results, int i, R_xlen_t length, const double* values)
+{
+	SET_VECTOR_ELT(results, i, Rf_allocVector(REALSXP, length));
+	double* x = REAL(VECTOR_ELT(results, i));
+	for (R_xlen_t j=0; j<length; j++) x[j] = (values == NULL) ? 0 : values[j];
+	return x;
 }
 
+SEXP univariate_hmm_call(SEXP params)
+{
+	// Inputs, read in place
+	int T = int_param(params, "num.bins", 1)[0];
+	int N = int_param(params, "num.states", 1)[0];
+	int* O = int_param(params, "counts", T);
+	int* state_labels = int_param(params, "state.labels", N);
+	int* distr_type = int_param(params, "distr.type", N);
+	int num_chunks = int_param(params, "num.chunks", 1)[0];
+	int* chunk_lengths = int_param(params, "chunk.lengths", num_chunks);
+	int num_segments = int_param(params, "num.segments", 1)[0];
+	int* segment_lengths = int_param(params, "segment.lengths", num_segments);
+	int num_threads = int_param(params, "num.threads", 1)[0];
+	int read_cutoff = int_param(params, "count.cutoff", 1)[0];
+	int algorithm = int_param(params, "algorithm", 1)[0];
+	int verbosity = int_param(params, "verbosity", 1)[0];
+	char* checkpoint_file = string_param(params, "checkpoint.file");
+	int checkpoint_interval = int_param(params, "checkpoint.interval", 1)[0];
+	char* parameter_store = string_param(params, "parameter.store");
+	int store_mode = int_param(params, "store.mode", 1)[0];
+	int hmm_engine = int_param(params, "hmm.engine", 1)[0];
+	bool use_initial_params = logical_param(params, "use.initial.params");
+
+	// Results, the initial parameters and convergence criteria are copied because the HMM overwrites them
+	const char* names[] = {"size", "prob", "w", "num.iterations", "time.sec", "loglik.delta", "maxPosterior", "states", "A", "proba", "loglik", "weights", "error", "size.initial", "prob.initial", "w.initial", "A.initial", "proba.initial", "posteriorMargin", "posteriorEntropy"};
+	SEXP results = PROTECT(new_results(names, 20));
+	double* size = real_result(results, 0, N, NULL);
+	double* prob = real_result(results, 1, N, NULL);
+	double* w = real_result(results, 2, N, NULL);
+	int* maxiter = int_result(results, 3, 1, int_param(params, "num.iterations", 1)[0]);
+	int* maxtime = int_result(results, 4, 1, int_param(params, "time.sec", 1)[0]);
+	double* eps = real_result(results, 5, 1, real_param(params, "loglik.delta", 1));
+	double* maxPosterior = real_result(results, 6, T, NULL);
+	int* states = int_result(results, 7, T, 0);
+	double* A = real_result(results, 8, N*N, NULL);
+	double* proba = real_result(results, 9, N, NULL);
+	double* loglik = real_result(results, 10, 1, NULL);
+	double* weights = real_result(results, 11, N, NULL);
+	int* error = int_result(results, 12, 1, 0);
+	double* initial_size = real_result(results, 13, N, real_param(params, "size.initial", N));
+	double* initial_prob = real_result(results, 14, N, real_param(params, "prob.initial", N));
+	double* initial_w = real_result(results, 15, N, real_param(params, "w.initial", N));
+	double* initial_A = real_result(results, 16, N*N, real_param(params, "A.initial", N*N));
+	double* initial_proba = real_result(results, 17, N, real_param(params, "proba.initial", N));
+	double* margin = real_result(results, 18, T, NULL);
+	double* entropy = real_result(results, 19, T, NULL);
+
+	univariate_hmm(O, &T, &N, state_labels, size, prob, maxiter, maxtime, eps, maxPosterior, margin, entropy, states, A, proba, loglik, weights, distr_type, initial_size, initial_prob, initial_A, initial_proba, &use_initial_params, &num_threads, error, &read_cutoff, &algorithm, &verbosity, &checkpoint_file, &checkpoint_interval, &parameter_store, &store_mode, chunk_lengths, &num_chunks, segment_lengths, &num_segments, w, initial_w, &hmm_engine);
+	UNPROTECT(1);
+	return results;
+}
 
-// ====================================================================
-// C version of apply(array2D, 1, which.max) and apply(array2D, 1, max)
-// ====================================================================
-void array2D_which_max(double* array2D, int* dim, int* ind_max, double* value_max)
+SEXP bivariate_hmm_call(SEXP counts, SEXP params)
 {
-  // array2D is actually a vector, but is intended to originate from a 2D array in R
-	std::vector<double> value_per_i0(dim[1]);
-  for (int i0=0; i0<dim[0]; i0++)
-  {
-    for (int i1=0; i1<dim[1]; i1++)
-    {
-			value_per_i0[i1] = array2D[i1 * dim[0] + i0];
-      // if (*verbosity>=1) Rprintf("i0=%d, i1=%d, value_per_i0[%d] = %g\n", i0, i1, i1, value_per_i0[i1]);
-    }
-		ind_max[i0] = 1 + std::distance(value_per_i0.begin(), std::max_element(value_per_i0.begin(), value_per_i0.end()));
-    value_max[i0] = *std::max_element(value_per_i0.begin(), value_per_i0.end());
-  }
-	
+	// Inputs, read in place, counts is the matrix [T x Nmod] of both strands
+	int T = int_param(params, "num.bins", 1)[0];
+	int N = int_param(params, "num.comb.states", 1)[0];
+	int Nmod = int_param(params, "num.strands", 1)[0];
+	int num_states = int_param(params, "num.uni.states", 1)[0];
+	if ((TYPEOF(counts) != INTSXP) || (XLENGTH(counts) != (R_xlen_t) T * Nmod)) Rf_error("counts must be an integer matrix of num.bins x num.strands");
+	int* comb_states = int_param(params, "comb.states", Nmod * N);
+	int* distr_type = int_param(params, "distr.type", num_states * Nmod);
+	bool use_initial_params = logical_param(params, "use.initial.params");
+	int num_threads = int_param(params, "num.threads", 1)[0];
+	int algorithm = int_param(params, "algorithm", 1)[0];
+	int verbosity = int_param(params, "verbosity", 1)[0];
+
+	// Results, the marginals and correlations hold the initial values until the HMM overwrites them with the estimates
+	const char* names[] = {"size", "prob", "w", "cor.matrix", "num.iterations", "time.sec", "loglik.delta", "maxPosterior", "states", "A", "proba", "loglik", "error", "A.initial", "proba.initial", "posteriorMargin", "posteriorEntropy"};
+	SEXP results = PROTECT(new_results(names, 17));
+	double* size = real_result(results, 0, num_states * Nmod, real_param(params, "size", num_states * Nmod));
+	double* prob = real_result(results, 1, num_states * Nmod, real_param(params, "prob", num_states * Nmod));
+	double* w = real_result(results, 2, num_states * Nmod, real_param(params, "w", num_states * Nmod));
+	double* cor_matrix = real_result(results, 3, Nmod * Nmod * N, real_param(params, "cor.matrix", Nmod * Nmod * N));
+	int* maxiter = int_result(results, 4, 1, int_param(params, "num.iterations", 1)[0]);
+	int* maxtime = int_result(results, 5, 1, int_param(params, "time.sec", 1)[0]);
+	double* eps = real_result(results, 6, 1, real_param(params, "loglik.delta", 1));
+	double* maxPosterior = real_result(results, 7, T, NULL);
+	int* states = int_result(results, 8, T, 0);
+	double* A = real_result(results, 9, N*N, NULL);
+	double* proba = real_result(results, 10, N, NULL);
+	double* loglik = real_result(results, 11, 1, NULL);
+	int* error = int_result(results, 12, 1, 0);
+	double* initial_A = real_result(results, 13, N*N, real_param(params, "A.initial", N*N));
+	double* initial_proba = real_result(results, 14, N, real_param(params, "proba.initial", N));
+	double* margin = real_result(results, 15, T, NULL);
+	double* entropy = real_result(results, 16, T, NULL);
+
+	bivariate_hmm(INTEGER(counts), &T, &N, &Nmod, &num_states, comb_states, distr_type, size, prob, w, cor_matrix, maxiter, maxtime, eps, maxPosterior, margin, entropy, states, A, proba, loglik, initial_A, initial_proba, &use_initial_params, &num_threads, error, &algorithm, &verbosity);
+	UNPROTECT(1);
+	return results;
+}
+
+// ===================================================================================================================================================
+// This function times the vectorized special functions against the scalar library functions that the densities used before
+// ===================================================================================================================================================
+void benchmark_specfun(int* n, int* reps, double* seconds, double* maxerror)
+{
+	// Arguments spread logarithmically over [1e-3,1e6] for the gamma functions, linearly over [-700,700] for exp() and logarithmically towards both tails for qnorm()
+	std::vector<double> x(*n), xexp(*n), xqnorm(*n), vec(*n), scalar(*n);
+	for (int i=0; i<*n; i++)
+	{
+		x[i] = pow(10.0, -3.0 + 9.0 * i / *n);
+		xexp[i] = -700.0 + 1400.0 * i / *n;
+		xqnorm[i] = (i % 2 == 0) ? pow(10.0, -300.0 * (i+1) / *n) : 1.0 - pow(10.0, -16.0 * i / *n);
+	}
+	void (*vec_functions[])(const double*, int, double*) = {exp_vec, log_vec, lgamma_vec, digamma_vec, trigamma_vec, qnorm_vec};
+	for (int f=0; f<6; f++)
+	{
+		const double* arg = (f==0) ? &xexp[0] : ((f==5) ? &xqnorm[0] : &x[0]);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int r=0; r<*reps; r++)
+		{
+			vec_functions[f](arg, *n, &vec[0]);
+		}
+		std::chrono::steady_clock::time_point middle = std::chrono::steady_clock::now();
+		for (int r=0; r<*reps; r++)
+		{
+			for (int i=0; i<*n; i++)
+			{
+				switch (f)
+				{
+					case 0: scalar[i] = exp(arg[i]); break;
+					case 1: scalar[i] = log(arg[i]); break;
+					case 2: scalar[i] = lgamma(arg[i]); break;
+					case 3: scalar[i] = digamma(arg[i]); break;
+					case 4: scalar[i] = trigamma(arg[i]); break;
+					case 5: scalar[i] = qnorm(arg[i], 0.0, 1.0, 1, 0); break;
+				}
+			}
+		}
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		seconds[2*f] = std::chrono::duration<double>(middle - start).count();
+		seconds[2*f+1] = std::chrono::duration<double>(end - middle).count();
+		// Error in units in the last place (ulp) of the library value, of max(1,|f(x)|) close to the roots of log(), lgamma(), digamma() and qnorm()
+		maxerror[f] = 0;
+		for (int i=0; i<*n; i++)
+		{
+			double scale = (f==0 || f==4) ? fabs(scalar[i]) : std::max(1.0, fabs(scalar[i]));
+			double ulp = nextafter(scale, INFINITY) - scale;
+			maxerror[f] = std::max(maxerror[f], fabs(vec[i] - scalar[i]) / ulp);
+		}
+	}
 }
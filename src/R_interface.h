@@ -3,8 +3,11 @@
 
 #include "utility.h"
 #include "scalehmm.h"
-#include "loghmm.h"
+#include "parameterstore.h"
 #include <string> // strcmp
+#include <chrono> // steady_clock
+#define R_NO_REMAP // keep length() etc. from clashing with the C++ library
+#include <Rinternals.h> // SEXP for the .Call interface
 
 // #if defined TARGET_OS_MAC || defined __APPLE__
 // #include <libiomp/omp.h> // parallelization options on mac
@@ -13,16 +16,38 @@
 // #endif
 
 extern "C"
-void univariate_hmm(int* O, int* T, int* N, int* state_labels, double* size, double* prob, int* maxiter, int* maxtime, double* eps, double* maxPosterior, int* states, double* A, double* proba, double* loglik, double* weights, int* distr_type, double* initial_size, double* initial_prob, double* initial_A, double* initial_proba, bool* use_initial_params, int* num_threads, int* error, int* read_cutoff, int* algorithm, int* verbosity);
+void univariate_hmm(int* O, int* T, int* N, int* state_labels, double* size, double* prob, int* maxiter, int* maxtime, double* eps, double* maxPosterior, double* margin, double* entropy, int* states, double* A, double* proba, double* loglik, double* weights, int* distr_type, double* initial_size, double* initial_prob, double* initial_A, double* initial_proba, bool* use_initial_params, int* num_threads, int* error, int* read_cutoff, int* algorithm, int* verbosity, char** checkpoint_file, int* checkpoint_interval, char** parameter_store, int* store_mode, int* chunk_lengths, int* num_chunks, int* segment_lengths, int* num_segments, double* w, double* initial_w, int* hmm_engine);
 
 extern "C"
-void multivariate_hmm(double* D, int* T, int* N, int *Nmod, int* comb_states, int* maxiter, int* maxtime, double* eps, double* maxPosterior, int* states, double* A, double* proba, double* loglik, double* initial_A, double* initial_proba, bool* use_initial_params, int* num_threads, int* error, int* algorithm, int* verbosity);
+void univariate_cleanup();
 
 extern "C"
-void univariate_cleanup();
+void multivariate_cleanup();
+
+extern "C"
+void posterior_summary(double* posteriors, int* T, int* N, int* ind_max, double* value_max, int* num_threads);
+
+extern "C"
+void copula_zvalues(int* counts, int* num_bins, int* num_models, int* num_states, int* distr_type, double* size, double* prob, double* w, double* z_per_bin);
+
+extern "C"
+void copula_correlations(double* z_per_bin, int* num_bins, int* num_models, int* num_comb_states, int* comb_states, int* comb_state_per_bin, double* cor_matrix, double* cor_matrix_inv, double* determinant);
+
+extern "C"
+void copula_densities(int* counts, int* num_bins, int* num_models, int* num_states, int* distr_type, double* size, double* prob, double* w, int* num_comb_states, int* comb_states, double* cor_matrix_inv, double* determinant, int* num_threads, double* densities);
+
+extern "C"
+void bivariate_hmm(int* O, int* T, int* N, int* Nmod, int* num_states, int* comb_states, int* distr_type, double* size, double* prob, double* w, double* cor_matrix, int* maxiter, int* maxtime, double* eps, double* maxPosterior, double* margin, double* entropy, int* states, double* A, double* proba, double* loglik, double* initial_A, double* initial_proba, bool* use_initial_params, int* num_threads, int* error, int* algorithm, int* verbosity);
+
+extern "C"
+void univariate_densities(int* O, int* T, int* N, int* distr_type, double* size, double* prob, bool* fused, double* densities);
+void bivariate_hmms(int* O, int* num_cells, int* T, int* N, int* Nmod, int* num_states, int* comb_states, int* distr_type, double* size, double* prob, double* w, double* cor_matrix, int* maxiter, int* maxtime, double* eps, double* maxPosterior, int* states, double* A, double* proba, double* loglik, double* initial_A, double* initial_proba, bool* use_initial_params, int* num_threads, int* error, int* verbosity);
+
+extern "C"
+void benchmark_specfun(int* n, int* reps, double* seconds, double* maxerror);
 
 extern "C"
-void multivariate_cleanup(int* N);
+SEXP univariate_hmm_call(SEXP params);
 
 extern "C"
-void array2D_which_max(double* array2D, int* dim, int* ind_max, double* value_max);
+SEXP bivariate_hmm_call(SEXP counts, SEXP params);
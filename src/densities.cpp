@@ -3,6 +3,17 @@
 
 #include "densities.h"
 
+// Turns a table of densities for j=0..max_obs into the cumulative distribution function in place, capped at 1 against the rounding error of the sum
+static void cumulate_densities(double* values, int max_obs)
+{
+	double sum = 0;
+	for (int j=0; j<=max_obs; j++)
+	{
+		sum += values[j];
+		values[j] = sum < 1.0 ? sum : 1.0;
+	}
+}
+
 // ============================================================
 // Normal (Gaussian) density
 // ============================================================
@@ -43,6 +54,15 @@ void Normal::calc_logdensities(double* logdensity)
 	}
 }
 
+void Normal::calc_logdensities_per_read(double* logdens_per_read, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	for (int j=0; j<=max_obs; j++)
+	{
+		logdens_per_read[j] = dnorm(j, this->mean, this->sd, 1);
+	}
+}
+
 void Normal::update(double* weights)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
@@ -50,6 +70,14 @@ void Normal::update(double* weights)
 // TODO
 }
 
+void Normal::set_observations(int* observations, int T)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	this->obs = observations;
+	this->T = T;
+	this->version++;
+}
+
 // Getter and Setter ------------------------------------------
 DensityName Normal::get_name()
 {
@@ -72,7 +100,9 @@ double Normal::get_mean()
 void Normal::set_mean(double mean)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	double mean_old = this->mean;
 	this->mean = mean;
+	if (this->mean != mean_old) { this->version++; }
 }
 
 double Normal::get_variance()
@@ -84,8 +114,10 @@ double Normal::get_variance()
 void Normal::set_variance(double variance)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	double variance_old = this->variance, sd_old = this->sd;
 	this->variance = variance;
 	this->sd = sqrt(variance);
+	if ((this->variance != variance_old) || (this->sd != sd_old)) { this->version++; }
 }
 
 double Normal::get_stdev()
@@ -97,8 +129,10 @@ double Normal::get_stdev()
 void Normal::set_stdev(double stdev)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	double sd_old = this->sd;
 	this->sd = stdev;
 	this->variance = stdev*stdev;
+	if (this->sd != sd_old) { this->version++; }
 }
 
 
@@ -115,27 +149,17 @@ Poisson::Poisson(int* observations, int T, double lambda)
 	this->T = T;
 	this->lambda = lambda;
 	this->lxfactorials = NULL;
-	// Precompute the lxfactorials that are used in computing the densities
+	// Get the precomputed lxfactorials that are used in computing the densities
 	if (this->obs != NULL)
 	{
 		this->max_obs = intMax(observations, T);
-		this->lxfactorials = (double*) Calloc(max_obs+1, double);
-		this->lxfactorials[0] = 0.0;	// Not necessary, already 0 because of Calloc
-		this->lxfactorials[1] = 0.0;
-		for (int j=2; j<=max_obs; j++)
-		{
-			this->lxfactorials[j] = this->lxfactorials[j-1] + log(j);
-		}
+		this->lxfactorials = lxfactorial_table(this->max_obs); // shared between all densities, must not be freed
 	}
 }
 
 Poisson::~Poisson()
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
-	if (this->lxfactorials != NULL)
-	{
-		Free(this->lxfactorials);
-	}
 }
 
 // Methods ----------------------------------------------------
@@ -184,6 +208,25 @@ void Poisson::calc_logdensities(double* logdens)
 	}
 } 
 
+void Poisson::calc_densities_per_read(double* dens_per_read, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// max_obs must not exceed the maximum of the observations given in the constructor (size of lxfactorials)
+	double logl = log(this->lambda);
+	double l = this->lambda;
+	for (int j=0; j<=max_obs; j++)
+	{
+		dens_per_read[j] = exp( j*logl - l - this->lxfactorials[j] );
+	}
+}
+
+void Poisson::calc_cdf_per_read(double* cdf_per_read, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	this->calc_densities_per_read(cdf_per_read, max_obs);
+	cumulate_densities(cdf_per_read, max_obs);
+}
+
 void Poisson::calc_densities(double* dens)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
@@ -195,10 +238,7 @@ void Poisson::calc_densities(double* dens)
 	{
 		//FILE_LOG(logDEBUG2) << "Precomputing densities in " << __func__ << " for every obs[t], because max(O)<=T";
 		std::vector<double> dens_per_read(this->max_obs+1);
-		for (int j=0; j<=this->max_obs; j++)
-		{
-			dens_per_read[j] = exp( j*logl - l - this->lxfactorials[j] );
-		}
+		this->calc_densities_per_read(&dens_per_read[0], this->max_obs);
 		for (int t=0; t<this->T; t++)
 		{
 			dens[t] = dens_per_read[(int) this->obs[t]];
@@ -229,9 +269,28 @@ void Poisson::calc_densities(double* dens)
 	}
 } 
 
+void Poisson::calc_logdensities_per_read(double* logdens_per_read, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// max_obs must not exceed the maximum of the observations given in the constructor (size of lxfactorials)
+	double logl = log(this->lambda);
+	double l = this->lambda;
+	for (int j=0; j<=max_obs; j++)
+	{
+		logdens_per_read[j] = j*logl - l - this->lxfactorials[j];
+		if (std::isnan(logdens_per_read[j]))
+		{
+			//FILE_LOG(logERROR) << __PRETTY_FUNCTION__;
+			//FILE_LOG(logERROR) << "logdens_per_read["<<j<<"] = "<< logdens_per_read[j];
+			throw nan_detected;
+		}
+	}
+}
+
 void Poisson::update(double* weights)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	double lambda_old = this->lambda;
 	double numerator, denominator;
 	// Update lambda
 	numerator=denominator=0.0;
@@ -249,12 +308,14 @@ void Poisson::update(double* weights)
 // 	dtime = clock() - time;
 // 	//FILE_LOG(logDEBUG1) << "updateL(): "<<dtime<< " clicks";
 	//FILE_LOG(logDEBUG1) << "l = " << this->lambda;
+	if (this->lambda != lambda_old) { this->version++; }
 
 }
 
 void Poisson::update_constrained(double** weights, int fromState, int toState)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	double lambda_old = this->lambda;
 	//FILE_LOG(logDEBUG1) << "l = "<<this->lambda;
 	double numerator, denominator;
 	// Update lambda
@@ -276,7 +337,58 @@ void Poisson::update_constrained(double** weights, int fromState, int toState)
 // 	dtime = clock() - time;
 // 	//FILE_LOG(logDEBUG1) << "updateL(): "<<dtime<< " clicks";
 	//FILE_LOG(logDEBUG1) << "l = "<<this->lambda;
+	if (this->lambda != lambda_old) { this->version++; }
+
+}
+
+void Poisson::update_from_histogram(double* weights, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	double lambda_old = this->lambda;
+	double numerator, denominator;
+	// Update lambda, weights[j] is the summed weight of all observations with value j
+	numerator=denominator=0.0;
+	for (int j=0; j<=max_obs; j++)
+	{
+		numerator += weights[j] * j;
+		denominator += weights[j];
+	}
+	if (denominator > 0) // only update if not nan
+	{
+		this->lambda = numerator/denominator;
+	}
+	if (this->lambda != lambda_old) { this->version++; }
+}
+
+void Poisson::update_constrained_from_histogram(double** weights, int max_obs, int fromState, int toState)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	double lambda_old = this->lambda;
+	double numerator, denominator;
+	// Update lambda, weights[i][j] is the summed weight of all observations with value j in state i
+	numerator=denominator=0.0;
+	for (int i=0; i<toState-fromState; i++)
+	{
+		for (int j=0; j<=max_obs; j++)
+		{
+			numerator += weights[i+fromState][j] * j;
+			denominator += weights[i+fromState][j] * (i+1);
+		}
+	}
+	if (denominator > 0) // only update if not nan
+	{
+		this->lambda = numerator/denominator;
+	}
+	if (this->lambda != lambda_old) { this->version++; }
+}
 
+void Poisson::set_observations(int* observations, int T)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// Precomputed tables are sized for the observations given to the constructor, so these must not be exceeded
+	this->obs = observations;
+	this->T = T;
+	this->version++;
 }
 
 // Getter and Setter ------------------------------------------
@@ -289,7 +401,9 @@ double Poisson::get_mean()
 void Poisson::set_mean(double mean)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	double lambda_old = this->lambda;
 	this->lambda = mean;
+	if (this->lambda != lambda_old) { this->version++; }
 }
 
 double Poisson::get_variance()
@@ -301,7 +415,9 @@ double Poisson::get_variance()
 void Poisson::set_variance(double variance)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	double lambda_old = this->lambda;
 	this->lambda = variance;
+	if (this->lambda != lambda_old) { this->version++; }
 }
 
 DensityName Poisson::get_name()
@@ -337,27 +453,17 @@ NegativeBinomial::NegativeBinomial(int* observations, int T, double size, double
 	this->size = size;
 	this->prob = prob;
 	this->lxfactorials = NULL;
-	// Precompute the lxfactorials that are used in computing the densities
+	// Get the precomputed lxfactorials that are used in computing the densities
 	if (this->obs != NULL)
 	{
 		this->max_obs = intMax(observations, T);
-		this->lxfactorials = (double*) Calloc(max_obs+1, double);
-		this->lxfactorials[0] = 0.0;	// Not necessary, already 0 because of Calloc
-		this->lxfactorials[1] = 0.0;
-		for (int j=2; j<=max_obs; j++)
-		{
-			this->lxfactorials[j] = this->lxfactorials[j-1] + log(j);
-		}
+		this->lxfactorials = lxfactorial_table(this->max_obs); // shared between all densities, must not be freed
 	}
 }
 
 NegativeBinomial::~NegativeBinomial()
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
-	if (this->lxfactorials != NULL)
-	{
-		Free(this->lxfactorials);
-	}
 }
 
 // Methods ----------------------------------------------------
@@ -373,9 +479,11 @@ void NegativeBinomial::calc_logdensities(double* logdens)
 	{
 		//FILE_LOG(logDEBUG2) << "Precomputing gammas in " << __func__ << " for every obs[t], because max(O)<=T";
 		std::vector<double> logdens_per_read(this->max_obs+1);
+		std::vector<double> lGammaRplusX(this->max_obs+1);
+		lgamma_table(this->size, this->max_obs, &lGammaRplusX[0]);
 		for (int j=0; j<=this->max_obs; j++)
 		{
-			logdens_per_read[j] = lgamma(this->size + j) - lGammaR - lxfactorials[j] + this->size * logp + j * log1minusp;
+			logdens_per_read[j] = lGammaRplusX[j] - lGammaR - lxfactorials[j] + this->size * logp + j * log1minusp;
 		}
 		for (int t=0; t<this->T; t++)
 		{
@@ -392,9 +500,15 @@ void NegativeBinomial::calc_logdensities(double* logdens)
 	else
 	{
 		//FILE_LOG(logDEBUG2) << "Computing gammas in " << __func__ << " for every t, because max(O)>T";
+		// Compute the gammas of all bins at once with the vectorized kernels
+		for (int t=0; t<this->T; t++)
+		{
+			logdens[t] = this->size + this->obs[t];
+		}
+		lgamma_vec(logdens, this->T, logdens);
 		for (int t=0; t<this->T; t++)
 		{
-			lGammaRplusX = lgamma(this->size + this->obs[t]);
+			lGammaRplusX = logdens[t];
 			lxfactorial = this->lxfactorials[(int) this->obs[t]];
 			logdens[t] = lGammaRplusX - lGammaR - lxfactorial + this->size * logp + this->obs[t] * log1minusp;
 			//FILE_LOG(logDEBUG4) << "logdens["<<t<<"] = " << logdens[t];
@@ -408,6 +522,69 @@ void NegativeBinomial::calc_logdensities(double* logdens)
 	}
 } 
 
+void NegativeBinomial::calc_densities_per_read(double* dens_per_read, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	NegativeBinomial* member = this;
+	NegativeBinomial::calc_densities_per_read(&member, 1, &dens_per_read, max_obs);
+}
+
+void NegativeBinomial::calc_cdf_per_read(double* cdf_per_read, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	this->calc_densities_per_read(cdf_per_read, max_obs);
+	cumulate_densities(cdf_per_read, max_obs);
+}
+
+void NegativeBinomial::calc_densities_per_read(NegativeBinomial** members, int num_members, double** dens_per_read, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// Tables for several negative binomials at once, e.g. the tied states that are multiples of the monosomy, sharing the table of 1/j
+	// The densities follow from the ratio d(j)/d(j-1) = (size+j-1)*(1-prob)/j, without lgamma() and exp() for every j
+	// The recurrence runs outwards from the mode so that the values only decrease, and every 64 steps the density is evaluated directly to limit the accumulated rounding error
+	// max_obs must not exceed the maximum of the observations given in the constructors (size of lxfactorials)
+	const int anchor_interval = 64;
+	std::vector<double> inverse(max_obs+1);
+	inverse[0] = 0.0;
+	for (int j=1; j<=max_obs; j++)
+	{
+		inverse[j] = 1.0 / j;
+	}
+	for (int i=0; i<num_members; i++)
+	{
+		NegativeBinomial* d = members[i];
+		double* dens = dens_per_read[i];
+		double logp = log(d->prob);
+		double log1minusp = log(1-d->prob);
+		double q = 1-d->prob;
+		double lGammaR = lgamma(d->size);
+		double mode_d = floor((d->size - 1) * q / d->prob);
+		int mode = (mode_d > 0) ? ((mode_d < max_obs) ? (int) mode_d : max_obs) : 0;
+		for (int j=mode; j<=max_obs; j++)
+		{
+			if ((j - mode) % anchor_interval == 0)
+			{
+				dens[j] = exp( lgamma(d->size + j) - lGammaR - d->lxfactorials[j] + d->size * logp + j * log1minusp );
+			}
+			else
+			{
+				dens[j] = dens[j-1] * ((d->size + j - 1) * q * inverse[j]);
+			}
+		}
+		for (int j=mode-1; j>=0; j--)
+		{
+			if ((mode - j) % anchor_interval == 0)
+			{
+				dens[j] = exp( lgamma(d->size + j) - lGammaR - d->lxfactorials[j] + d->size * logp + j * log1minusp );
+			}
+			else
+			{
+				dens[j] = dens[j+1] * ((j + 1) / ((d->size + j) * q));
+			}
+		}
+	}
+}
+
 void NegativeBinomial::calc_densities(double* dens)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
@@ -420,10 +597,7 @@ void NegativeBinomial::calc_densities(double* dens)
 	{
 		//FILE_LOG(logDEBUG2) << "Precomputing gammas in " << __func__ << " for every obs[t], because max(O)<=T";
 		std::vector<double> dens_per_read(this->max_obs+1);
-		for (int j=0; j<=this->max_obs; j++)
-		{
-			dens_per_read[j] = exp( lgamma(this->size + j) - lGammaR - lxfactorials[j] + this->size * logp + j * log1minusp );
-		}
+		this->calc_densities_per_read(&dens_per_read[0], this->max_obs);
 		for (int t=0; t<this->T; t++)
 		{
 			dens[t] = dens_per_read[(int) this->obs[t]];
@@ -439,11 +613,21 @@ void NegativeBinomial::calc_densities(double* dens)
 	else
 	{
 		//FILE_LOG(logDEBUG2) << "Computing gammas in " << __func__ << " for every t, because max(O)>T";
+		// Compute the gammas and exponentials of all bins at once with the vectorized kernels
+		for (int t=0; t<this->T; t++)
+		{
+			dens[t] = this->size + this->obs[t];
+		}
+		lgamma_vec(dens, this->T, dens);
 		for (int t=0; t<this->T; t++)
 		{
-			lGammaRplusX = lgamma(this->size + this->obs[t]);
+			lGammaRplusX = dens[t];
 			lxfactorial = this->lxfactorials[(int) this->obs[t]];
-			dens[t] = exp( lGammaRplusX - lGammaR - lxfactorial + this->size * logp + this->obs[t] * log1minusp );
+			dens[t] = lGammaRplusX - lGammaR - lxfactorial + this->size * logp + this->obs[t] * log1minusp;
+		}
+		exp_vec(dens, this->T, dens);
+		for (int t=0; t<this->T; t++)
+		{
 			//FILE_LOG(logDEBUG4) << "dens["<<t<<"] = " << dens[t];
 			if (std::isnan(dens[t]))
 			{
@@ -455,263 +639,188 @@ void NegativeBinomial::calc_densities(double* dens)
 	}
 } 
 
+void NegativeBinomial::calc_logdensities_per_read(double* logdens_per_read, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// max_obs must not exceed the maximum of the observations given in the constructor (size of lxfactorials)
+	double logp = log(this->prob);
+	double log1minusp = log(1-this->prob);
+	double lGammaR = lgamma(this->size);
+	std::vector<double> lGammaRplusX(max_obs+1);
+	lgamma_table(this->size, max_obs, &lGammaRplusX[0]);
+	for (int j=0; j<=max_obs; j++)
+	{
+		logdens_per_read[j] = lGammaRplusX[j] - lGammaR - lxfactorials[j] + this->size * logp + j * log1minusp;
+		if (std::isnan(logdens_per_read[j]))
+		{
+			//FILE_LOG(logERROR) << __PRETTY_FUNCTION__;
+			//FILE_LOG(logERROR) << "logdens_per_read["<<j<<"] = "<< logdens_per_read[j];
+			throw nan_detected;
+		}
+	}
+}
+
 void NegativeBinomial::update(double* weights)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
-	//FILE_LOG(logDEBUG1) << "size = "<<this->size << ", prob = "<<this->prob;
+	// Sum the weights per observed value, so that the Newton iterations do not depend on T
+	std::vector<double> histogram(this->max_obs+1, 0.0);
+	for (int t=0; t<this->T; t++)
+	{
+		histogram[this->obs[t]] += weights[t];
+	}
+	this->update_from_histogram(&histogram[0], this->max_obs);
+}
+
+void NegativeBinomial::update_constrained(double** weights, int fromState, int toState)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// Sum the weights per observed value, so that the Newton iterations do not depend on T
+	double** histogram = CallocDoubleMatrix(toState, this->max_obs+1);
+	for (int i=fromState; i<toState; i++)
+	{
+		for (int t=0; t<this->T; t++)
+		{
+			histogram[i][this->obs[t]] += weights[i][t];
+		}
+	}
+	this->update_constrained_from_histogram(histogram, this->max_obs, fromState, toState);
+	FreeDoubleMatrix(histogram, toState);
+}
+
+void NegativeBinomial::update_from_histogram(double* weights, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	double size_old = this->size, prob_old = this->prob;
 	double eps = 1e-4;
 	double kmax = 20;
 	double numerator, denominator, size0, DigammaSize, TrigammaSize;
 	double F, dFdSize, FdivM;
 	double logp = log(this->prob);
-	// Update prob (p)
+	// Update prob (p), weights[j] is the summed weight of all observations with value j
 	numerator=denominator=0.0;
-// 	clock_t time, dtime;
-// 	time = clock();
-	for (int t=0; t<this->T; t++)
+	for (int j=0; j<=max_obs; j++)
 	{
-		numerator += weights[t] * this->size;
-		denominator += weights[t] * (this->size + this->obs[t]);
+		numerator += weights[j] * this->size;
+		denominator += weights[j] * (this->size + j);
 	}
 	if (denominator > 0) // only update if not nan
 	{
 		this->prob = numerator/denominator; // Update this->prob
 	}
-// 	logp = log(this->prob); // Update of size is done with new prob
-	
-// 	dtime = clock() - time;
-// 	//FILE_LOG(logDEBUG1) << "updateP(): "<<dtime<< " clicks";
 
 	// Update of size with Newton Method
 	size0 = this->size;
-// 	time = clock();
-	// Select strategy for computing digammas
-	if (this->max_obs <= this->T)
+	std::vector<double> DigammaSizePlusX(max_obs+1);
+	std::vector<double> TrigammaSizePlusX(max_obs+1);
+	for (int k=0; k<kmax; k++)
 	{
-		//FILE_LOG(logDEBUG2) << "Precomputing digammas in " << __func__ << " for every obs[t], because max(O)<=T";
-		std::vector<double> DigammaSizePlusX(this->max_obs+1);
-		std::vector<double> TrigammaSizePlusX(this->max_obs+1);
-		for (int k=0; k<kmax; k++)
+		F = weights[0] * logp;
+		dFdSize = 0.0;
+		DigammaSize = digamma(size0);
+		TrigammaSize = trigamma(size0);
+		digamma_table(size0, max_obs, &DigammaSizePlusX[0]);
+		trigamma_table(size0, max_obs, &TrigammaSizePlusX[0]);
+		for (int j=1; j<=max_obs; j++)
 		{
-			F=dFdSize=0.0;
-			DigammaSize = digamma(size0); // boost::math::digamma<>(size0);
-			TrigammaSize = trigamma(size0); // boost::math::digamma<>(size0);
-			// Precompute the digammas by iterating over all possible values of the observation vector
-			for (int j=0; j<=this->max_obs; j++)
-			{
-				DigammaSizePlusX[j] = digamma(size0+j);
-				TrigammaSizePlusX[j] = trigamma(size0+j);
-			}
-			for(int t=0; t<this->T; t++)
-			{
-				if(this->obs[t]==0)
-				{
-					F += weights[t] * logp;
-					//dFdSize+=0;
-				}
-				if(this->obs[t]!=0)
-				{
-					F += weights[t] * (logp - DigammaSize + DigammaSizePlusX[(int)obs[t]]);
-					dFdSize += weights[t] * (-TrigammaSize + TrigammaSizePlusX[(int)obs[t]]);
-				}
-			}
-			FdivM = F/dFdSize;
-// Rprintf("k = %d, F = %g, dFdSize = %g, FdivM = %g, size0 = %g\n", k, F, dFdSize, FdivM, size0);
-			if (FdivM < size0)
-			{
-				size0 = size0-FdivM;
-			}
-			else if (FdivM >= size0)
-			{
-				size0 = size0/2.0;
-			}
-			if(fabs(F)<eps)
-			{
-				break;
-			}
+			if (weights[j] == 0) continue;
+			F += weights[j] * (logp - DigammaSize + DigammaSizePlusX[j]);
+			dFdSize += weights[j] * (-TrigammaSize + TrigammaSizePlusX[j]);
 		}
-	}
-	else
-	{
-		//FILE_LOG(logDEBUG2) << "Computing digammas in " << __func__ << " for every t, because max(O)>T";
-		double DigammaSizePlusX, TrigammaSizePlusX;
-		for (int k=0; k<kmax; k++)
+		FdivM = F/dFdSize;
+		if (FdivM < size0)
 		{
-			F = dFdSize = 0.0;
-			DigammaSize = digamma(size0); // boost::math::digamma<>(size0);
-			TrigammaSize = trigamma(size0); // boost::math::digamma<>(size0);
-			for(int t=0; t<this->T; t++)
-			{
-				DigammaSizePlusX = digamma(size0+this->obs[t]); //boost::math::digamma<>(size0+this->obs[ti]);
-				TrigammaSizePlusX = trigamma(size0+this->obs[t]);
-				if(this->obs[t]==0)
-				{
-					F += weights[t] * logp;
-					//dFdSize+=0;
-				}
-				if(this->obs[t]!=0)
-				{
-					F += weights[t] * (logp - DigammaSize + DigammaSizePlusX);
-					dFdSize += weights[t] * (-TrigammaSize + TrigammaSizePlusX);
-				}
-			}
-			FdivM = F/dFdSize;
-			if (FdivM < size0)
-			{
-				size0 = size0-FdivM;
-			}
-			else if (FdivM >= size0)
-			{
-				size0 = size0/2.0;
-			}
-			if(fabs(F)<eps)
-			{
-				break;
-			}
+			size0 = size0-FdivM;
+		}
+		else if (FdivM >= size0)
+		{
+			size0 = size0/2.0;
+		}
+		if(fabs(F)<eps)
+		{
+			break;
 		}
 	}
 	this->size = size0;
 	//FILE_LOG(logDEBUG1) << "size = "<<this->size << ", prob = "<<this->prob;
 	this->mean = this->fmean(this->size, this->prob);
 	this->variance = this->fvariance(this->size, this->prob);
-
-// 	dtime = clock() - time;
-// 	//FILE_LOG(logDEBUG1) << "updateR(): "<<dtime<< " clicks";
-
+	if ((this->size != size_old) || (this->prob != prob_old)) { this->version++; }
 }
 
-void NegativeBinomial::update_constrained(double** weights, int fromState, int toState)
+void NegativeBinomial::update_constrained_from_histogram(double** weights, int max_obs, int fromState, int toState)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
-	//FILE_LOG(logDEBUG1) << "size = "<<this->size << ", prob = "<<this->prob;
+	double size_old = this->size, prob_old = this->prob;
 	double eps = 1e-4;
 	double kmax = 20;
 	double numerator, denominator, size0, DigammaSize, TrigammaSize;
 	double F, dFdSize, FdivM;
 	double logp = log(this->prob);
-	// Update prob (p)
+	// Update prob (p), weights[i][j] is the summed weight of all observations with value j in state i
 	numerator=denominator=0.0;
-// 	clock_t time, dtime;
-// 	time = clock();
 	for (int i=0; i<toState-fromState; i++)
 	{
-		for (int t=0; t<this->T; t++)
+		for (int j=0; j<=max_obs; j++)
 		{
-			numerator += weights[i+fromState][t] * this->size*(i+1);
-			denominator += weights[i+fromState][t] * (this->size*(i+1) + this->obs[t]);
+			numerator += weights[i+fromState][j] * this->size*(i+1);
+			denominator += weights[i+fromState][j] * (this->size*(i+1) + j);
 		}
 	}
 	if (denominator > 0) // only update if not nan
 	{
 		this->prob = numerator/denominator; // Update this->prob
 	}
-// 	logp = log(this->prob); // Update of size is done with new prob
-	
-// 	dtime = clock() - time;
-// 	//FILE_LOG(logDEBUG1) << "updateP(): "<<dtime<< " clicks";
 
 	// Update of size with Newton Method
 	size0 = this->size;
-// 	time = clock();
-	// Select strategy for computing digammas
-	if (this->max_obs <= this->T)
+	std::vector<double> DigammaSizePlusX(max_obs+1);
+	std::vector<double> TrigammaSizePlusX(max_obs+1);
+	for (int k=0; k<kmax; k++)
 	{
-		//FILE_LOG(logDEBUG2) << "Precomputing digammas in " << __func__ << " for every obs[t], because max(O)<=T";
-		std::vector<double> DigammaSizePlusX(this->max_obs+1);
-		std::vector<double> TrigammaSizePlusX(this->max_obs+1);
-		for (int k=0; k<kmax; k++)
+		F=dFdSize=0.0;
+		for (int i=0; i<toState-fromState; i++)
 		{
-			F=dFdSize=0.0;
-			for (int i=0; i<toState-fromState; i++)
-			{
-				DigammaSize = digamma((i+1)*size0); // boost::math::digamma<>(size0);
-				TrigammaSize = trigamma((i+1)*size0); // boost::math::digamma<>(size0);
-				// Precompute the digammas by iterating over all possible values of the observation vector
-				for (int j=0; j<=this->max_obs; j++)
-				{
-					DigammaSizePlusX[j] = digamma((i+1)*size0+j);
-					TrigammaSizePlusX[j] = trigamma((i+1)*size0+j);
-				}
-				for(int t=0; t<this->T; t++)
-				{
-					if(this->obs[t]==0)
-					{
-						F += weights[i+fromState][t] * (i+1) * logp;
-						//dFdSize+=0;
-					}
-					if(this->obs[t]!=0)
-					{
-						F += weights[i+fromState][t] * (i+1) * (logp - DigammaSize + DigammaSizePlusX[(int)obs[t]]);
-						dFdSize += weights[i+fromState][t] * pow((i+1),2) * (-TrigammaSize + TrigammaSizePlusX[(int)obs[t]]);
-					}
-				}
-			}
-			FdivM = F/dFdSize;
-// Rprintf("k = %d, F = %g, dFdSize = %g, FdivM = %g, size0 = %g, prob = %g\n", k, F, dFdSize, FdivM, size0, this->prob);
-			if (FdivM < size0)
-			{
-				size0 = size0-FdivM;
-			}
-			else if (FdivM >= size0)
-			{
-				size0 = size0/2.0;
-			}
-			if(fabs(F)<eps)
+			DigammaSize = digamma((i+1)*size0);
+			TrigammaSize = trigamma((i+1)*size0);
+			digamma_table((i+1)*size0, max_obs, &DigammaSizePlusX[0]);
+			trigamma_table((i+1)*size0, max_obs, &TrigammaSizePlusX[0]);
+			F += weights[i+fromState][0] * (i+1) * logp;
+			for (int j=1; j<=max_obs; j++)
 			{
-				break;
+				if (weights[i+fromState][j] == 0) continue;
+				F += weights[i+fromState][j] * (i+1) * (logp - DigammaSize + DigammaSizePlusX[j]);
+				dFdSize += weights[i+fromState][j] * pow((i+1),2) * (-TrigammaSize + TrigammaSizePlusX[j]);
 			}
 		}
-	}
-	else
-	{
-		//FILE_LOG(logDEBUG2) << "Computing digammas in " << __func__ << " for every t, because max(O)>T";
-		double DigammaSizePlusX, TrigammaSizePlusX;
-		for (int k=0; k<kmax; k++)
+		FdivM = F/dFdSize;
+		if (FdivM < size0)
 		{
-			F = dFdSize = 0.0;
-			for (int i=0; i<toState-fromState; i++)
-			{
-				DigammaSize = digamma((i+1)*size0); // boost::math::digamma<>(size0);
-				TrigammaSize = trigamma((i+1)*size0); // boost::math::digamma<>(size0);
-				for(int t=0; t<this->T; t++)
-				{
-					DigammaSizePlusX = digamma((i+1)*size0+this->obs[t]); //boost::math::digamma<>(size0+this->obs[ti]);
-					TrigammaSizePlusX = trigamma((i+1)*size0+this->obs[t]);
-					if(this->obs[t]==0)
-					{
-						F += weights[i+fromState][t] * (i+1) * logp;
-						//dFdSize+=0;
-					}
-					if(this->obs[t]!=0)
-					{
-						F += weights[i+fromState][t] * (i+1) * (logp - DigammaSize + DigammaSizePlusX);
-						dFdSize += weights[i+fromState][t] * pow((i+1),2) * (-TrigammaSize + TrigammaSizePlusX);
-					}
-				}
-			}
-			FdivM = F/dFdSize;
-			if (FdivM < size0)
-			{
-				size0 = size0-FdivM;
-			}
-			else if (FdivM >= size0)
-			{
-				size0 = size0/2.0;
-			}
-			if(fabs(F)<eps)
-			{
-				break;
-			}
+			size0 = size0-FdivM;
+		}
+		else if (FdivM >= size0)
+		{
+			size0 = size0/2.0;
+		}
+		if(fabs(F)<eps)
+		{
+			break;
 		}
 	}
 	this->size = size0;
 	//FILE_LOG(logDEBUG1) << "size = "<<this->size << ", prob = "<<this->prob;
 	this->mean = this->fmean(this->size, this->prob);
 	this->variance = this->fvariance(this->size, this->prob);
+	if ((this->size != size_old) || (this->prob != prob_old)) { this->version++; }
+}
 
-// 	dtime = clock() - time;
-// 	//FILE_LOG(logDEBUG1) << "updateR(): "<<dtime<< " clicks";
-
+void NegativeBinomial::set_observations(int* observations, int T)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// Precomputed tables are sized for the observations given to the constructor, so these must not be exceeded
+	this->obs = observations;
+	this->T = T;
+	this->version++;
 }
 
 double NegativeBinomial::fsize(double mean, double variance)
@@ -748,9 +857,11 @@ double NegativeBinomial::get_mean()
 void NegativeBinomial::set_mean(double mean)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	double size_old = this->size, prob_old = this->prob;
 	double variance = this->get_variance();
 	this->size = this->fsize( mean, variance );
 	this->prob = this->fprob( mean, variance );
+	if ((this->size != size_old) || (this->prob != prob_old)) { this->version++; }
 }
 
 double NegativeBinomial::get_variance()
@@ -762,9 +873,11 @@ double NegativeBinomial::get_variance()
 void NegativeBinomial::set_variance(double variance)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	double size_old = this->size, prob_old = this->prob;
 	double mean = this->get_mean();
 	this->size = this->fsize( mean, variance );
 	this->prob = this->fprob( mean, variance );
+	if ((this->size != size_old) || (this->prob != prob_old)) { this->version++; }
 }
 
 DensityName NegativeBinomial::get_name()
@@ -805,6 +918,13 @@ Binomial::Binomial(int* observations, int T, double size, double prob)
 	this->T = T;
 	this->size = size;
 	this->prob = prob;
+	this->lxfactorials = NULL;
+	// Get the precomputed lxfactorials that are used in computing the densities
+	if (this->obs != NULL)
+	{
+		this->max_obs = intMax(observations, T);
+		this->lxfactorials = lxfactorial_table(this->max_obs); // shared between all densities, must not be freed
+	}
 }
 
 Binomial::~Binomial()
@@ -823,30 +943,28 @@ void Binomial::calc_logdensities(double* logdens)
 	{
 		//FILE_LOG(logDEBUG2) << "Precomputing densities in " << __func__ << " for every obs[t], because max(O)<=T";
 		std::vector<double> logdens_per_read (this->max_obs+1);
-		for (int j=0; j<=this->max_obs; j++)
-		{
-			logdens_per_read[j] = lchoose(this->size, j) + j * logp + (this->size-j) * log1minusp;
-		}
+		this->calc_logdensities_per_read(&logdens_per_read[0], this->max_obs);
 		for (int t=0; t<this->T; t++)
 		{
 			logdens[t] = logdens_per_read[(int) this->obs[t]];
 			//FILE_LOG(logDEBUG4) << "logdens["<<t<<"] = " << logdens[t];
-			if (std::isnan(logdens[t]))
-			{
-				//FILE_LOG(logERROR) << __PRETTY_FUNCTION__;
-				//FILE_LOG(logERROR) << "logdens["<<t<<"] = "<< logdens[t];
-				throw nan_detected;
-			}
 		}
 	}
 	else
 	{
 		//FILE_LOG(logDEBUG2) << "Computing densities in " << __func__ << " for every t, because max(O)>T";
+		// Compute the gammas of all bins at once with the vectorized kernels, lchoose(size,j) = lgamma(size+1) - log(j!) - lgamma(size-j+1)
+		double lGammaSizePlus1 = lgamma(this->size + 1);
+		for (int t=0; t<this->T; t++)
+		{
+			logdens[t] = this->size - this->obs[t] + 1;
+		}
+		lgamma_vec(logdens, this->T, logdens);
 		int j;
 		for (int t=0; t<this->T; t++)
 		{
 			j = (int) this->obs[t];
-			logdens[t] = lchoose(this->size, j) + j * logp + (this->size-j) * log1minusp;
+			logdens[t] = lGammaSizePlus1 - this->lxfactorials[j] - logdens[t] + j * logp + (this->size-j) * log1minusp;
 			//FILE_LOG(logDEBUG4) << "logdens["<<t<<"] = " << logdens[t];
 			if (std::isnan(logdens[t]))
 			{
@@ -858,27 +976,67 @@ void Binomial::calc_logdensities(double* logdens)
 	}
 } 
 
-void Binomial::calc_densities(double* dens)
+void Binomial::calc_densities_per_read(double* dens_per_read, int max_obs)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// The densities follow from the ratio d(j)/d(j-1) = |size-j+1|/j * prob/(1-prob), as for the negative binomial
+	// |size-j+1| keeps the sign convention of lchoose() for non-integer size, for integer size the densities beyond size are zero
+	// max_obs must not exceed the maximum of the observations given in the constructor (size of lxfactorials)
+	const int anchor_interval = 64;
 	double logp = log(this->prob);
 	double log1minusp = log(1-this->prob);
-	// Select strategy for computing gammas
-	if (this->max_obs <= this->T)
+	double odds = this->prob / (1-this->prob);
+	double mode_d = floor((this->size + 1) * this->prob);
+	int mode = (mode_d > 0) ? ((mode_d < max_obs) ? (int) mode_d : max_obs) : 0;
+	for (int j=mode; j<=max_obs; j++)
 	{
-		//FILE_LOG(logDEBUG2) << "Precomputing densities in " << __func__ << " for every obs[t], because max(O)<=T";
-		std::vector<double> dens_per_read (this->max_obs+1);
-		for (int j=0; j<=this->max_obs; j++)
+		if ((j - mode) % anchor_interval == 0)
 		{
 			dens_per_read[j] = exp( lchoose(this->size, j) + j * logp + (this->size-j) * log1minusp );
 		}
-		for (int t=0; t<this->T; t++)
+		else
 		{
-			dens[t] = dens_per_read[(int) this->obs[t]];
-			//FILE_LOG(logDEBUG4) << "dens["<<t<<"] = " << dens[t];
-			if (std::isnan(dens[t]))
-			{
-				//FILE_LOG(logERROR) << __PRETTY_FUNCTION__;
+			dens_per_read[j] = dens_per_read[j-1] * (fabs(this->size - j + 1) / j * odds);
+		}
+	}
+	for (int j=mode-1; j>=0; j--)
+	{
+		if ((mode - j) % anchor_interval == 0)
+		{
+			dens_per_read[j] = exp( lchoose(this->size, j) + j * logp + (this->size-j) * log1minusp );
+		}
+		else
+		{
+			dens_per_read[j] = dens_per_read[j+1] * ((j + 1) / (fabs(this->size - j) * odds));
+		}
+	}
+}
+
+void Binomial::calc_cdf_per_read(double* cdf_per_read, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	this->calc_densities_per_read(cdf_per_read, max_obs);
+	cumulate_densities(cdf_per_read, max_obs);
+}
+
+void Binomial::calc_densities(double* dens)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	double logp = log(this->prob);
+	double log1minusp = log(1-this->prob);
+	// Select strategy for computing gammas
+	if (this->max_obs <= this->T)
+	{
+		//FILE_LOG(logDEBUG2) << "Precomputing densities in " << __func__ << " for every obs[t], because max(O)<=T";
+		std::vector<double> dens_per_read (this->max_obs+1);
+		this->calc_densities_per_read(&dens_per_read[0], this->max_obs);
+		for (int t=0; t<this->T; t++)
+		{
+			dens[t] = dens_per_read[(int) this->obs[t]];
+			//FILE_LOG(logDEBUG4) << "dens["<<t<<"] = " << dens[t];
+			if (std::isnan(dens[t]))
+			{
+				//FILE_LOG(logERROR) << __PRETTY_FUNCTION__;
 				//FILE_LOG(logERROR) << "dens["<<t<<"] = "<< dens[t];
 				throw nan_detected;
 			}
@@ -887,11 +1045,22 @@ void Binomial::calc_densities(double* dens)
 	else
 	{
 		//FILE_LOG(logDEBUG2) << "Computing densities in " << __func__ << " for every t, because max(O)>T";
+		// Compute the gammas and exponentials of all bins at once with the vectorized kernels
+		double lGammaSizePlus1 = lgamma(this->size + 1);
+		for (int t=0; t<this->T; t++)
+		{
+			dens[t] = this->size - this->obs[t] + 1;
+		}
+		lgamma_vec(dens, this->T, dens);
 		int j;
 		for (int t=0; t<this->T; t++)
 		{
 			j = (int) this->obs[t];
-			dens[t] = exp( lchoose(this->size, j) + j * logp + (this->size-j) * log1minusp );
+			dens[t] = lGammaSizePlus1 - this->lxfactorials[j] - dens[t] + j * logp + (this->size-j) * log1minusp;
+		}
+		exp_vec(dens, this->T, dens);
+		for (int t=0; t<this->T; t++)
+		{
 			//FILE_LOG(logDEBUG4) << "dens["<<t<<"] = " << dens[t];
 			if (std::isnan(dens[t]))
 			{
@@ -903,127 +1072,134 @@ void Binomial::calc_densities(double* dens)
 	}
 } 
 
+void Binomial::calc_logdensities_per_read(double* logdens_per_read, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	double logp = log(this->prob);
+	double log1minusp = log(1-this->prob);
+	for (int j=0; j<=max_obs; j++)
+	{
+		logdens_per_read[j] = lchoose(this->size, j) + j * logp + (this->size-j) * log1minusp;
+		if (std::isnan(logdens_per_read[j]))
+		{
+			//FILE_LOG(logERROR) << __PRETTY_FUNCTION__;
+			//FILE_LOG(logERROR) << "logdens_per_read["<<j<<"] = "<< logdens_per_read[j];
+			throw nan_detected;
+		}
+	}
+}
+
+// Computes digamma(offset - j) for all observed values j at once with the vectorized kernel
+static void digamma_shifted(double offset, const std::vector<int>& values, std::vector<double>& result)
+{
+	int n = values.size();
+	for (int i=0; i<n; i++)
+	{
+		result[i] = offset - values[i];
+	}
+	if (n > 0)
+	{
+		digamma_vec(&result[0], n, &result[0]);
+	}
+}
+
 void Binomial::update(double* weights)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// Sum the weights per observed value, so that the Newton iterations do not depend on T
+	std::vector<double> histogram(this->max_obs+1, 0.0);
+	for (int t=0; t<this->T; t++)
+	{
+		histogram[this->obs[t]] += weights[t];
+	}
+	this->update_from_histogram(&histogram[0], this->max_obs);
+}
+
+void Binomial::update_constrained(double** weights, int fromState, int toState)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// Sum the weights per observed value, so that the Newton iterations do not depend on T
+	double** histogram = CallocDoubleMatrix(toState, this->max_obs+1);
+	for (int i=fromState; i<toState; i++)
+	{
+		for (int t=0; t<this->T; t++)
+		{
+			histogram[i][this->obs[t]] += weights[i][t];
+		}
+	}
+	this->update_constrained_from_histogram(histogram, this->max_obs, fromState, toState);
+	FreeDoubleMatrix(histogram, toState);
+}
+
+void Binomial::update_from_histogram(double* weights, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	double size_old = this->size, prob_old = this->prob;
 	double eps = 1e-4, kmax;
 	double numerator, denominator, size0, F, dFdSize, DigammaSizePlus1, DigammaSizePlusDSizePlus1;
 	double dSize;
-	// Update prob (p)
+	// Update prob (p), weights[j] is the summed weight of all observations with value j
 	numerator=denominator=0.0;
-// 	clock_t time, dtime;
-// 	time = clock();
-	for (int t=0; t<this->T; t++)
+	for (int j=0; j<=max_obs; j++)
 	{
-		numerator += weights[t] * this->obs[t];
-		denominator += weights[t] * this->size;
+		numerator += weights[j] * j;
+		denominator += weights[j] * this->size;
 	}
 	if (denominator > 0) // only update if not nan
 	{
 		this->prob = numerator/denominator; // Update of size is now done with updated prob
 	}
 	double log1minusp = log(1-this->prob);
-// 	dtime = clock() - time;
-// 	//FILE_LOG(logDEBUG1) << "updateP(): "<<dtime<< " clicks";
-	// Update of size with Newton Method
+	// Update of size with Newton Method, the digammas of all observed values with nonzero weight are computed at once
+	std::vector<int> values;
+	for (int j=1; j<=max_obs; j++)
+	{
+		if (weights[j] != 0) values.push_back(j);
+	}
+	std::vector<double> DigammaSizeMinusXPlus1(values.size()), DigammaSizePlusDSizeMinusXPlus1(values.size());
 	size0 = this->size;
 	dSize = 0.00001;
 	kmax = 20;
-// 	time = clock();
-	// Select strategy for computing digammas
-	if (this->max_obs <= this->T)
+	for (int k=1; k<kmax; k++)
 	{
-		//FILE_LOG(logDEBUG2) << "Precomputing digammas in " << __func__ << " for every obs[t], because max(O)<=T";
-		std::vector<double> DigammaSizeMinusXPlus1(this->max_obs+1);
-		std::vector<double> DigammaSizePlusDSizeMinusXPlus1(this->max_obs+1);
-		for (int k=1; k<kmax; k++)
+		F = weights[0] * log1minusp;
+		dFdSize = 0.0;
+		DigammaSizePlus1 = digamma(size0+1);
+		DigammaSizePlusDSizePlus1 = digamma((size0+dSize)+1);
+		digamma_shifted(size0+1, values, DigammaSizeMinusXPlus1);
+		digamma_shifted((size0+dSize)+1, values, DigammaSizePlusDSizeMinusXPlus1);
+		for (unsigned int v=0; v<values.size(); v++)
 		{
-			F=dFdSize=0.0;
-			DigammaSizePlus1 = digamma(size0+1);
-			DigammaSizePlusDSizePlus1 = digamma((size0+dSize)+1);
-			// Precompute the digammas by iterating over all possible values of the observation vector
-			for (int j=0; j<=this->max_obs; j++)
-			{
-				DigammaSizeMinusXPlus1[j] = digamma(size0-j+1);
-				DigammaSizePlusDSizeMinusXPlus1[j] = digamma((size0+dSize)-j+1);
-			}
-			for(int t=0; t<this->T; t++)
-			{
-				if(this->obs[t]==0)
-				{
-					F += weights[t] * log1minusp;
-					//dFdSize+=0;
-				}
-				if(this->obs[t]!=0)
-				{
-					F += weights[t] * (DigammaSizePlus1 - DigammaSizeMinusXPlus1[(int)this->obs[t]] + log1minusp);
-					dFdSize += weights[t]/dSize * (DigammaSizePlusDSizePlus1-DigammaSizePlus1 - DigammaSizePlusDSizeMinusXPlus1[(int)this->obs[t]]+DigammaSizeMinusXPlus1[(int)this->obs[t]]);
-				}
-			}
-			if(fabs(F)<eps)
-{
-				break;
-			}
-			if(F/dFdSize<size0) size0=size0-F/dFdSize;
-			if(F/dFdSize>size0) size0=size0/2.0;
+			int j = values[v];
+			F += weights[j] * (DigammaSizePlus1 - DigammaSizeMinusXPlus1[v] + log1minusp);
+			dFdSize += weights[j]/dSize * (DigammaSizePlusDSizePlus1-DigammaSizePlus1 - DigammaSizePlusDSizeMinusXPlus1[v]+DigammaSizeMinusXPlus1[v]);
 		}
-	}
-	else
-	{
-		//FILE_LOG(logDEBUG2) << "Computing digammas in " << __func__ << " for every t, because max(O)>T";
-		double DigammaSizeMinusXPlus1, DigammaSizePlusDSizeMinusXPlus1;
-// 		double DigammaSizePlusX, DigammaSizePlusDSizePlusX;
-		for (int k=1; k<kmax; k++)
+		if(fabs(F)<eps)
 		{
-			F = dFdSize = 0.0;
-			DigammaSizePlus1 = digamma(size0+1);
-			DigammaSizePlusDSizePlus1 = digamma((size0+dSize)+1);
-			for(int t=0; t<this->T; t++)
-			{
-				DigammaSizeMinusXPlus1 = digamma(size0-(int)this->obs[t]+1);
-				DigammaSizePlusDSizeMinusXPlus1 = digamma((size0+dSize)-(int)this->obs[t]+1);
-				if(this->obs[t]==0)
-				{
-					F += weights[t] * log1minusp;
-					//dFdSize+=0;
-				}
-				if(this->obs[t]!=0)
-				{
-					F += weights[t] * (DigammaSizePlus1 - DigammaSizeMinusXPlus1 + log1minusp);
-					dFdSize += weights[t]/dSize * (DigammaSizePlusDSizePlus1-DigammaSizePlus1 - DigammaSizePlusDSizeMinusXPlus1+DigammaSizeMinusXPlus1);
-				}
-			}
-			if(fabs(F)<eps)
-			{
-				break;
-			}
-			if(F/dFdSize<size0) size0=size0-F/dFdSize;
-			if(F/dFdSize>size0) size0=size0/2.0;
+			break;
 		}
+		if(F/dFdSize<size0) size0=size0-F/dFdSize;
+		if(F/dFdSize>size0) size0=size0/2.0;
 	}
 	this->size = size0;
 	//FILE_LOG(logDEBUG1) << "r = "<<this->size << ", p = "<<this->prob;
-
-// 	dtime = clock() - time;
-// 	//FILE_LOG(logDEBUG1) << "updateR(): "<<dtime<< " clicks";
-
+	if ((this->size != size_old) || (this->prob != prob_old)) { this->version++; }
 }
 
-void Binomial::update_constrained(double** weights, int fromState, int toState)
+void Binomial::update_constrained_from_histogram(double** weights, int max_obs, int fromState, int toState)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	double size_old = this->size, prob_old = this->prob;
 	double eps = 1e-4, kmax;
 	double numerator, denominator, size0, dSize, F, dFdSize, DigammaSizePlus1, DigammaSizePlusDSizePlus1;
-	// Update prob (p)
+	// Update prob (p), weights[i][j] is the summed weight of all observations with value j in state i
 	numerator=denominator=0.0;
-// 	clock_t time, dtime;
-// 	time = clock();
 	for (int i=0; i<toState-fromState; i++)
 	{
-		for (int t=0; t<this->T; t++)
+		for (int j=0; j<=max_obs; j++)
 		{
-			numerator += weights[i+fromState][t] * this->obs[t];
-			denominator += weights[i+fromState][t] * (i+1)*this->size;
+			numerator += weights[i+fromState][j] * j;
+			denominator += weights[i+fromState][j] * (i+1)*this->size;
 		}
 	}
 	if (denominator > 0) // only update if not nan
@@ -1031,95 +1207,54 @@ void Binomial::update_constrained(double** weights, int fromState, int toState)
 		this->prob = numerator/denominator; // Update of size is now done with updated prob
 	}
 	double log1minusp = log(1-this->prob);
-// 	dtime = clock() - time;
-// 	//FILE_LOG(logDEBUG1) << "updateP(): "<<dtime<< " clicks";
-	// Update of size with Newton Method
+	// Update of size with Newton Method, the digammas of all observed values with nonzero weight in a state are computed at once
+	std::vector< std::vector<int> > values(toState-fromState);
+	for (int i=0; i<toState-fromState; i++)
+	{
+		for (int j=1; j<=max_obs; j++)
+		{
+			if (weights[i+fromState][j] != 0) values[i].push_back(j);
+		}
+	}
+	std::vector<double> DigammaSizeMinusXPlus1(max_obs), DigammaSizePlusDSizeMinusXPlus1(max_obs);
 	size0 = this->size;
 	dSize = 0.00001;
 	kmax = 20;
-// 	time = clock();
-	// Select strategy for computing digammas
-	if (this->max_obs <= this->T)
+	for (int k=1; k<kmax; k++)
 	{
-		//FILE_LOG(logDEBUG2) << "Precomputing digammas in " << __func__ << " for every obs[t], because max(O)<=T";
-		std::vector<double> DigammaSizeMinusXPlus1(this->max_obs+1);
-		std::vector<double> DigammaSizePlusDSizeMinusXPlus1(this->max_obs+1);
-		for (int k=1; k<kmax; k++)
+		F=dFdSize=0.0;
+		for (int i=0; i<toState-fromState; i++)
 		{
-			F=dFdSize=0.0;
-			for (int i=0; i<toState-fromState; i++)
+			DigammaSizePlus1 = digamma(size0*(i+1) + 1);
+			DigammaSizePlusDSizePlus1 = digamma((size0+dSize)*(i+1) + 1);
+			F += weights[i+fromState][0] * (i+1) * log1minusp;
+			digamma_shifted((i+1)*size0+1, values[i], DigammaSizeMinusXPlus1);
+			digamma_shifted((i+1)*(size0+dSize)+1, values[i], DigammaSizePlusDSizeMinusXPlus1);
+			for (unsigned int v=0; v<values[i].size(); v++)
 			{
-				DigammaSizePlus1 = digamma(size0*(i+1) + 1);
-				DigammaSizePlusDSizePlus1 = digamma((size0+dSize)*(i+1) + 1);
-				// Precompute the digammas by iterating over all possible values of the observation vector
-				for (int j=0; j<=this->max_obs; j++)
-				{
-					DigammaSizeMinusXPlus1[j] = digamma((i+1)*size0-j+1);
-					DigammaSizePlusDSizeMinusXPlus1[j] = digamma((i+1)*(size0+dSize)-j+1);
-				}
-				for(int t=0; t<this->T; t++)
-				{
-					if(this->obs[t]==0)
-					{
-						F += weights[i+fromState][t] * (i+1) * log1minusp;
-						//dFdSize+=0;
-					}
-					if(this->obs[t]!=0)
-					{
-						F += weights[i+fromState][t] * (i+1) * (DigammaSizePlus1 - DigammaSizeMinusXPlus1[(int)this->obs[t]] + log1minusp);
-						dFdSize += weights[i+fromState][t]/dSize * (i+1) * (DigammaSizePlusDSizePlus1-DigammaSizePlus1 - DigammaSizePlusDSizeMinusXPlus1[(int)this->obs[t]]+DigammaSizeMinusXPlus1[(int)this->obs[t]]);
-					}
-				}
-				if(fabs(F)<eps)
-	{
-					break;
-				}
+				int j = values[i][v];
+				F += weights[i+fromState][j] * (i+1) * (DigammaSizePlus1 - DigammaSizeMinusXPlus1[v] + log1minusp);
+				dFdSize += weights[i+fromState][j]/dSize * (i+1) * (DigammaSizePlusDSizePlus1-DigammaSizePlus1 - DigammaSizePlusDSizeMinusXPlus1[v]+DigammaSizeMinusXPlus1[v]);
 			}
-			if(F/dFdSize<size0) size0=size0-F/dFdSize;
-			if(F/dFdSize>size0) size0=size0/2.0;
-		}
-	}
-	else
-	{
-		//FILE_LOG(logDEBUG2) << "Computing digammas in " << __func__ << " for every t, because max(O)>T";
-		double DigammaSizeMinusXPlus1, DigammaSizePlusDSizeMinusXPlus1;
-// 		double DigammaSizePlusX, DigammaSizePlusDSizePlusX;
-		for (int k=1; k<kmax; k++)
-		{
-			F = dFdSize = 0.0;
-			for (int i=0; i<toState-fromState; i++)
+			if(fabs(F)<eps)
 			{
-				DigammaSizePlus1 = digamma((i+1)*size0+1);
-				DigammaSizePlusDSizePlus1 = digamma((i+1)*(size0+dSize)+1);
-				for(int t=0; t<this->T; t++)
-				{
-					DigammaSizeMinusXPlus1 = digamma((i+1)*size0-(int)this->obs[t]+1);
-					DigammaSizePlusDSizeMinusXPlus1 = digamma((i+1)*(size0+dSize)-(int)this->obs[t]+1);
-					if(this->obs[t]==0)
-					{
-						F += weights[i+fromState][t] * (i+1) * log1minusp;
-						//dFdSize+=0;
-					}
-					if(this->obs[t]!=0)
-					{
-						F += weights[i+fromState][t] * (i+1) * (DigammaSizePlus1 - DigammaSizeMinusXPlus1 + log1minusp);
-						dFdSize += weights[i+fromState][t]/dSize * (i+1) * (DigammaSizePlusDSizePlus1-DigammaSizePlus1 - DigammaSizePlusDSizeMinusXPlus1+DigammaSizeMinusXPlus1);
-					}
-				}
-				if(fabs(F)<eps)
-				{
-					break;
-				}
+				break;
 			}
-			if(F/dFdSize<size0) size0=size0-F/dFdSize;
-			if(F/dFdSize>size0) size0=size0/2.0;
 		}
+		if(F/dFdSize<size0) size0=size0-F/dFdSize;
+		if(F/dFdSize>size0) size0=size0/2.0;
 	}
 	this->size = size0;
 	//FILE_LOG(logDEBUG1) << "size = "<<this->size << ", prob = "<<this->prob;
+	if ((this->size != size_old) || (this->prob != prob_old)) { this->version++; }
+}
 
-// 	dtime = clock() - time;
-// 	//FILE_LOG(logDEBUG1) << "updateR(): "<<dtime<< " clicks";
+void Binomial::set_observations(int* observations, int T)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	this->obs = observations;
+	this->T = T;
+	this->version++;
 }
 
 double Binomial::fsize(double mean, double variance)
@@ -1156,9 +1291,11 @@ double Binomial::get_mean()
 void Binomial::set_mean(double mean)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	double size_old = this->size, prob_old = this->prob;
 	double variance = this->get_variance();
 	this->size = this->fsize( mean, variance );
 	this->prob = this->fprob( mean, variance );
+	if ((this->size != size_old) || (this->prob != prob_old)) { this->version++; }
 }
 
 double Binomial::get_variance()
@@ -1170,9 +1307,11 @@ double Binomial::get_variance()
 void Binomial::set_variance(double variance)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	double size_old = this->size, prob_old = this->prob;
 	double mean = this->get_mean();
 	this->size = this->fsize( mean, variance );
 	this->prob = this->fprob( mean, variance );
+	if ((this->size != size_old) || (this->prob != prob_old)) { this->version++; }
 }
 
 DensityName Binomial::get_name()
@@ -1200,6 +1339,270 @@ double Binomial::get_prob()
 }
 
 
+// ============================================================
+// Zero-inflated Negative Binomial density
+// ============================================================
+
+// Constructor and Destructor ---------------------------------
+ZeroInflatedNegativeBinomial::ZeroInflatedNegativeBinomial(int* observations, int T, double w, double size, double prob) : nbinom(observations, T, size, prob)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	this->name = ZERO_INFLATED_NEGATIVE_BINOMIAL;
+	this->obs = observations;
+	this->T = T;
+	this->w = w;
+	if (this->obs != NULL)
+	{
+		this->max_obs = intMax(observations, T);
+	}
+}
+
+ZeroInflatedNegativeBinomial::~ZeroInflatedNegativeBinomial()
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+}
+
+// Methods ----------------------------------------------------
+void ZeroInflatedNegativeBinomial::calc_logdensities(double* logdens)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// Densities of the negative binomial component, mixed with the zero-inflation afterwards
+	this->nbinom.calc_logdensities(logdens);
+	double log1minusw = log(1-this->w);
+	for (int t=0; t<this->T; t++)
+	{
+		if (this->obs[t] == 0)
+		{
+			logdens[t] = log( this->w + (1-this->w) * exp(logdens[t]) );
+		}
+		else
+		{
+			logdens[t] += log1minusw;
+		}
+		//FILE_LOG(logDEBUG4) << "logdens["<<t<<"] = " << logdens[t];
+		if (std::isnan(logdens[t]))
+		{
+			//FILE_LOG(logERROR) << __PRETTY_FUNCTION__;
+			//FILE_LOG(logERROR) << "logdens["<<t<<"] = "<< logdens[t];
+			throw nan_detected;
+		}
+	}
+}
+
+void ZeroInflatedNegativeBinomial::calc_densities(double* dens)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// Densities of the negative binomial component, mixed with the zero-inflation afterwards
+	this->nbinom.calc_densities(dens);
+	for (int t=0; t<this->T; t++)
+	{
+		dens[t] *= (1-this->w);
+		if (this->obs[t] == 0) dens[t] += this->w;
+		//FILE_LOG(logDEBUG4) << "dens["<<t<<"] = " << dens[t];
+		if (std::isnan(dens[t]))
+		{
+			//FILE_LOG(logERROR) << __PRETTY_FUNCTION__;
+			//FILE_LOG(logERROR) << "dens["<<t<<"] = "<< dens[t];
+			throw nan_detected;
+		}
+	}
+}
+
+void ZeroInflatedNegativeBinomial::calc_densities_per_read(double* dens_per_read, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	this->nbinom.calc_densities_per_read(dens_per_read, max_obs);
+	for (int j=0; j<=max_obs; j++)
+	{
+		dens_per_read[j] *= (1-this->w);
+	}
+	dens_per_read[0] += this->w;
+}
+
+void ZeroInflatedNegativeBinomial::calc_cdf_per_read(double* cdf_per_read, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	this->calc_densities_per_read(cdf_per_read, max_obs);
+	cumulate_densities(cdf_per_read, max_obs);
+}
+
+void ZeroInflatedNegativeBinomial::calc_logdensities_per_read(double* logdens_per_read, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	this->nbinom.calc_logdensities_per_read(logdens_per_read, max_obs);
+	double log1minusw = log(1-this->w);
+	logdens_per_read[0] = log( this->w + (1-this->w) * exp(logdens_per_read[0]) );
+	for (int j=1; j<=max_obs; j++)
+	{
+		logdens_per_read[j] += log1minusw;
+	}
+	if (std::isnan(logdens_per_read[0]) || std::isnan(log1minusw))
+	{
+		//FILE_LOG(logERROR) << __PRETTY_FUNCTION__;
+		//FILE_LOG(logERROR) << "logdens_per_read[0] = "<< logdens_per_read[0];
+		throw nan_detected;
+	}
+}
+
+void ZeroInflatedNegativeBinomial::update(double* weights)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// Sum the weights per observed value, so that the update does not depend on T
+	std::vector<double> histogram(this->max_obs+1, 0.0);
+	for (int t=0; t<this->T; t++)
+	{
+		histogram[this->obs[t]] += weights[t];
+	}
+	this->update_from_histogram(&histogram[0], this->max_obs);
+}
+
+void ZeroInflatedNegativeBinomial::update_constrained(double** weights, int fromState, int toState)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// Sum the weights per observed value, so that the update does not depend on T
+	double** histogram = CallocDoubleMatrix(toState, this->max_obs+1);
+	for (int i=fromState; i<toState; i++)
+	{
+		for (int t=0; t<this->T; t++)
+		{
+			histogram[i][this->obs[t]] += weights[i][t];
+		}
+	}
+	this->update_constrained_from_histogram(histogram, this->max_obs, fromState, toState);
+	FreeDoubleMatrix(histogram, toState);
+}
+
+void ZeroInflatedNegativeBinomial::update_from_histogram(double* weights, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	double w_old = this->w;
+	int nbinom_version_old = this->nbinom.get_version();
+	// Split the weight of the zeros into the part explained by the zero-inflation and the part explained by the negative binomial
+	double dens0 = this->w + (1-this->w) * pow(this->nbinom.get_prob(), this->nbinom.get_size());
+	double zeros = (dens0 > 0) ? weights[0] * this->w / dens0 : 0.0;
+	double sumweights = 0.0;
+	for (int j=0; j<=max_obs; j++)
+	{
+		sumweights += weights[j];
+	}
+	if (sumweights > 0) // only update if not nan
+	{
+		this->w = zeros / sumweights;
+	}
+	// The negative binomial is fitted to the remaining weights
+	std::vector<double> nbinom_weights(weights, weights+max_obs+1);
+	nbinom_weights[0] -= zeros;
+	this->nbinom.update_from_histogram(&nbinom_weights[0], max_obs);
+	//FILE_LOG(logDEBUG1) << "w = "<<this->w << ", r = "<<this->nbinom.get_size() << ", p = "<<this->nbinom.get_prob();
+	if ((this->w != w_old) || (this->nbinom.get_version() != nbinom_version_old)) { this->version++; }
+}
+
+void ZeroInflatedNegativeBinomial::update_constrained_from_histogram(double** weights, int max_obs, int fromState, int toState)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// The states from fromState to toState share the weight of the zero-inflation, and state i has size (i+1)*size
+	double w_old = this->w;
+	int nbinom_version_old = this->nbinom.get_version();
+	double** nbinom_weights = CallocDoubleMatrix(toState, max_obs+1);
+	double zeros = 0.0, sumweights = 0.0;
+	for (int i=0; i<toState-fromState; i++)
+	{
+		double dens0 = this->w + (1-this->w) * pow(this->nbinom.get_prob(), (i+1)*this->nbinom.get_size());
+		double zeros_i = (dens0 > 0) ? weights[i+fromState][0] * this->w / dens0 : 0.0;
+		for (int j=0; j<=max_obs; j++)
+		{
+			nbinom_weights[i+fromState][j] = weights[i+fromState][j];
+			sumweights += weights[i+fromState][j];
+		}
+		nbinom_weights[i+fromState][0] -= zeros_i;
+		zeros += zeros_i;
+	}
+	if (sumweights > 0) // only update if not nan
+	{
+		this->w = zeros / sumweights;
+	}
+	this->nbinom.update_constrained_from_histogram(nbinom_weights, max_obs, fromState, toState);
+	FreeDoubleMatrix(nbinom_weights, toState);
+	//FILE_LOG(logDEBUG1) << "w = "<<this->w << ", size = "<<this->nbinom.get_size() << ", prob = "<<this->nbinom.get_prob();
+	if ((this->w != w_old) || (this->nbinom.get_version() != nbinom_version_old)) { this->version++; }
+}
+
+void ZeroInflatedNegativeBinomial::set_observations(int* observations, int T)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	this->obs = observations;
+	this->T = T;
+	this->nbinom.set_observations(observations, T);
+	this->version++;
+}
+
+// Getter and Setter ------------------------------------------
+double ZeroInflatedNegativeBinomial::get_mean()
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	return( this->nbinom.get_mean() );
+}
+
+void ZeroInflatedNegativeBinomial::set_mean(double mean)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	int nbinom_version_old = this->nbinom.get_version();
+	this->nbinom.set_mean(mean);
+	if (this->nbinom.get_version() != nbinom_version_old) { this->version++; }
+}
+
+double ZeroInflatedNegativeBinomial::get_variance()
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	return( this->nbinom.get_variance() );
+}
+
+void ZeroInflatedNegativeBinomial::set_variance(double variance)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	int nbinom_version_old = this->nbinom.get_version();
+	this->nbinom.set_variance(variance);
+	if (this->nbinom.get_version() != nbinom_version_old) { this->version++; }
+}
+
+DensityName ZeroInflatedNegativeBinomial::get_name()
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	return(this->name);
+}
+
+void ZeroInflatedNegativeBinomial::set_name(DensityName name)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	this->name = name;
+}
+
+double ZeroInflatedNegativeBinomial::get_size()
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	return(this->nbinom.get_size());
+}
+
+double ZeroInflatedNegativeBinomial::get_prob()
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	return(this->nbinom.get_prob());
+}
+
+double ZeroInflatedNegativeBinomial::get_w()
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	return(this->w);
+}
+
+void ZeroInflatedNegativeBinomial::set_w(double w)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	if (w != this->w) { this->version++; }
+	this->w = w;
+}
+
+
 // ============================================================
 // Zero Inflation density
 // ============================================================
@@ -1236,6 +1639,25 @@ void ZeroInflation::calc_logdensities(double* logdens)
 	}
 }
 
+void ZeroInflation::calc_densities_per_read(double* dens_per_read, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	dens_per_read[0] = 1.0;
+	for (int j=1; j<=max_obs; j++)
+	{
+		dens_per_read[j] = 0.0;
+	}
+}
+
+void ZeroInflation::calc_cdf_per_read(double* cdf_per_read, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	for (int j=0; j<=max_obs; j++)
+	{
+		cdf_per_read[j] = 1.0;
+	}
+}
+
 void ZeroInflation::calc_densities(double* dens)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
@@ -1253,12 +1675,30 @@ void ZeroInflation::calc_densities(double* dens)
 	}
 }
 
+void ZeroInflation::calc_logdensities_per_read(double* logdens_per_read, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	logdens_per_read[0] = 0.0;
+	for (int j=1; j<=max_obs; j++)
+	{
+		logdens_per_read[j] = -INFINITY;
+	}
+}
+
 void ZeroInflation::update(double* weights)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
 	(void)weights;
 }
 
+void ZeroInflation::set_observations(int* observations, int T)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	this->obs = observations;
+	this->T = T;
+	this->version++;
+}
+
 // Getter and Setter ------------------------------------------
 DensityName ZeroInflation::get_name()
 {
@@ -1364,6 +1804,28 @@ void Geometric::calc_logdensities(double* logdens)
 	}
 } 
 
+void Geometric::calc_densities_per_read(double* dens_per_read, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	double p = this->prob;
+	double oneminusp = 1-this->prob;
+	for (int j=0; j<=max_obs; j++)
+	{
+		dens_per_read[j] = p * pow(oneminusp,j);
+	}
+}
+
+void Geometric::calc_cdf_per_read(double* cdf_per_read, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// P(X<=j) = 1 - (1-p)^(j+1), with log1p() and expm1() to keep the small probabilities of the lower tail accurate
+	double log1minusp = log1p(-this->prob);
+	for (int j=0; j<=max_obs; j++)
+	{
+		cdf_per_read[j] = -expm1((j+1) * log1minusp);
+	}
+}
+
 void Geometric::calc_densities(double* dens)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
@@ -1374,10 +1836,7 @@ void Geometric::calc_densities(double* dens)
 	{
 		//FILE_LOG(logDEBUG2) << "Precomputing densities in " << __func__ << " for every obs[t], because max(O)<=T";
 		std::vector<double> dens_per_read (this->max_obs+1);
-		for (int j=0; j<=this->max_obs; j++)
-		{
-			dens_per_read[j] = p * pow(oneminusp,j);
-		}
+		this->calc_densities_per_read(&dens_per_read[0], this->max_obs);
 		for (int t=0; t<this->T; t++)
 		{
 			dens[t] = dens_per_read[(int) this->obs[t]];
@@ -1407,27 +1866,67 @@ void Geometric::calc_densities(double* dens)
 	}
 } 
 
+void Geometric::calc_logdensities_per_read(double* logdens_per_read, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	double logp = log(this->prob);
+	double log1minusp = log(1-this->prob);
+	for (int j=0; j<=max_obs; j++)
+	{
+		logdens_per_read[j] = logp + j * log1minusp;
+		if (std::isnan(logdens_per_read[j]))
+		{
+			//FILE_LOG(logERROR) << __PRETTY_FUNCTION__;
+			//FILE_LOG(logERROR) << "logdens_per_read["<<j<<"] = "<< logdens_per_read[j];
+			throw nan_detected;
+		}
+	}
+}
+
 void Geometric::update(double* weights)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// Sum the weights per observed value
+	std::vector<double> histogram(this->max_obs+1, 0.0);
+	for (int t=0; t<this->T; t++)
+	{
+		histogram[this->obs[t]] += weights[t];
+	}
+	this->update_from_histogram(&histogram[0], this->max_obs);
+}
+
+void Geometric::update_from_histogram(double* weights, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	double prob_old = this->prob;
 	double numerator, denominator;
-	// Update prob (p)
+	// Update prob (p), weights[j] is the summed weight of all observations with value j
 	numerator=denominator=0.0;
-	for (int t=0; t<this->T; t++)
+	for (int j=0; j<=max_obs; j++)
 	{
-		numerator += weights[t];
-		denominator += weights[t]*(1+this->obs[t]);
+		numerator += weights[j];
+		denominator += weights[j]*(1+j);
 	}
 	if (denominator > 0) // only update if not nan
 	{
 		this->prob = numerator/denominator;
 	}
-	//FILE_LOG(logDEBUG1) << "p = "<<this->prob;
+	if (this->prob != prob_old) { this->version++; }
+}
+
+void Geometric::set_observations(int* observations, int T)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// Precomputed tables are sized for the observations given to the constructor, so these must not be exceeded
+	this->obs = observations;
+	this->T = T;
+	this->version++;
 }
 
 double Geometric::fprob(double mean, double variance)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	if (variance == 0) return(1.0); // all mass at zero
 	return( mean / variance );
 }
 
@@ -1453,8 +1952,10 @@ double Geometric::get_mean()
 void Geometric::set_mean(double mean)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
-	double variance = this->get_variance();
-	this->prob = this->fprob( mean, variance );
+	double prob_old = this->prob;
+	// the geometric has only one parameter, so the mean determines the variance
+	this->prob = 1.0 / (1.0 + mean);
+	if (this->prob != prob_old) { this->version++; }
 }
 
 double Geometric::get_variance()
@@ -1466,8 +1967,10 @@ double Geometric::get_variance()
 void Geometric::set_variance(double variance)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	double prob_old = this->prob;
 	double mean = this->get_mean();
 	this->prob = this->fprob( mean, variance );
+	if (this->prob != prob_old) { this->version++; }
 }
 
 DensityName Geometric::get_name()
@@ -1505,18 +2008,106 @@ MVCopulaApproximation::MVCopulaApproximation(int** multiobservations, int T, std
 	this->Nmod = this->marginals.size();
 	this->cor_matrix_inv = cor_matrix_inv;
 	this->cor_matrix_determinant = cor_matrix_determinant;
+	// The marginals do not change, so their densities and z-values are tabulated once over the observed values
+	this->tables.resize(2 * this->Nmod);
+	this->dens_per_read.resize(this->Nmod);
+	this->z_per_read.resize(this->Nmod);
+	for (int imod=0; imod<this->Nmod; imod++)
+	{
+		MVCopulaApproximation::tabulate_marginal(this->marginals[imod], intMax(this->multi_obs[imod], this->T), this->tables[2*imod], this->tables[2*imod+1]);
+		this->dens_per_read[imod] = &this->tables[2*imod][0];
+		this->z_per_read[imod] = &this->tables[2*imod+1][0];
+	}
+}
+
+MVCopulaApproximation::MVCopulaApproximation(int** multiobservations, int T, std::vector<const double*> dens_per_read, std::vector<const double*> z_per_read, double* cor_matrix_inv, double cor_matrix_determinant)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// The tables of the marginals are shared between the copulas of all states, they belong to the caller
+	this->name = OTHER;
+	this->multi_obs = multiobservations;
+	this->T = T;
+	this->Nmod = dens_per_read.size();
+	this->cor_matrix_inv = cor_matrix_inv;
+	this->cor_matrix_determinant = cor_matrix_determinant;
+	this->dens_per_read = dens_per_read;
+	this->z_per_read = z_per_read;
 }
 
 MVCopulaApproximation::~MVCopulaApproximation()
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
-	for (int imod=0; imod<this->Nmod; imod++)
+	for (unsigned int imod=0; imod<this->marginals.size(); imod++)
 	{
 		delete this->marginals[imod];
 	}
 }
 
 // Methods ----------------------------------------------------
+void MVCopulaApproximation::calc_densities(double* dens)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	this->calc_densities(dens, 0, this->T);
+}
+
+void MVCopulaApproximation::calc_densities(double* dens, int tstart, int tend)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// Gaussian copula density for t in [tstart,tend): product of the marginal densities * det(R)^(-1/2) * exp(-z^T (R^-1 - I) z / 2), with z the z-values of the marginals
+	// Like the former R implementation, a NaN exponent is set to zero and the densities are capped to [0,1]
+	double factor = 1.0 / sqrt(this->cor_matrix_determinant);
+	std::vector<double> z(this->Nmod);
+	for (int t=tstart; t<tend; t++)
+	{
+		double product = factor;
+		for (int imod=0; imod<this->Nmod; imod++)
+		{
+			int obs = this->multi_obs[imod][t];
+			product *= this->dens_per_read[imod][obs];
+			z[imod] = this->z_per_read[imod][obs];
+		}
+		double exponent = 0.0;
+		for (int imod=0; imod<this->Nmod; imod++)
+		{
+			double sum = -z[imod];
+			for (int jmod=0; jmod<this->Nmod; jmod++)
+			{
+				sum += this->cor_matrix_inv[imod * this->Nmod + jmod] * z[jmod];
+			}
+			exponent += z[imod] * sum;
+		}
+		exponent *= -0.5;
+		if (std::isnan(exponent))
+		{
+			exponent = 0.0;
+		}
+		dens[t] = product * exp(exponent);
+		if (dens[t] > 1.0) dens[t] = 1.0;
+		if (dens[t] < 0.0) dens[t] = 0.0;
+	}
+}
+
+void MVCopulaApproximation::tabulate_marginal(Density* marginal, int max_obs, std::vector<double>& dens_per_read, std::vector<double>& z_per_read)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	dens_per_read.resize(max_obs+1);
+	z_per_read.resize(max_obs+1);
+	marginal->calc_densities_per_read(&dens_per_read[0], max_obs);
+	MVCopulaApproximation::calc_zvalues_per_read(marginal, &z_per_read[0], max_obs);
+}
+
+void MVCopulaApproximation::calc_zvalues_per_read(Density* marginal, double* z_per_read, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// z-values qnorm(P(X<=j)) for j=0..max_obs, where a CDF of 1 gives qnorm(1-1e-16) instead of Inf
+	double zmax = qnorm(1-1e-16, 0.0, 1.0, 1, 0);
+	marginal->calc_cdf_per_read(z_per_read, max_obs);
+	qnorm_vec(z_per_read, max_obs+1, z_per_read);
+	for (int j=0; j<=max_obs; j++)
+	{
+		if (z_per_read[j] > zmax) z_per_read[j] = zmax;
+	}
+}
 
 // Getter and Setter ------------------------------------------
 DensityName MVCopulaApproximation::get_name()
@@ -1532,3 +2123,70 @@ void MVCopulaApproximation::set_name(DensityName name)
 }
 
 
+// ============================================================
+// Tied updates of the copy-number states
+// ============================================================
+
+// Set the dependent states after iN as multiples of the state iN, which was updated before
+static void set_tied_densities(std::vector<Density*>& densityFunctions, int iN)
+{
+	int N = densityFunctions.size();
+	double mean1 = densityFunctions[iN]->get_mean();
+	double variance1 = densityFunctions[iN]->get_variance();
+	//FILE_LOG(logDEBUG1) << "mean(state="<<iN<<") = " << mean1 << ", var(state="<<iN<<") = " << variance1;
+	for (int jN=iN+1; jN<N; jN++)
+	{
+		densityFunctions[jN]->set_mean(mean1 * (jN-iN+1));
+		densityFunctions[jN]->set_variance(variance1 * (jN-iN+1));
+		if (densityFunctions[jN]->get_name() == ZERO_INFLATED_NEGATIVE_BINOMIAL)
+		{
+			// The weight of the zero-inflation is shared
+			((ZeroInflatedNegativeBinomial*) densityFunctions[jN])->set_w( ((ZeroInflatedNegativeBinomial*) densityFunctions[iN])->get_w() );
+		}
+		//FILE_LOG(logDEBUG1) << "mean(state="<<jN<<") = " << densityFunctions[jN]->get_mean() << ", var(state="<<jN<<") = " << densityFunctions[jN]->get_variance();
+	}
+}
+
+static bool is_tied_density(Density* d)
+{
+	return (d->get_name() == NEGATIVE_BINOMIAL) || (d->get_name() == BINOMIAL) || (d->get_name() == ZERO_INFLATED_NEGATIVE_BINOMIAL);
+}
+
+void update_tied_densities(std::vector<Density*>& densityFunctions, double** gamma)
+{
+	// Update distribution of independent states first, set others as multiples of 'monosomy'
+	// This loop assumes that the dependent (negative) binomial states come last and are consecutive
+	int N = densityFunctions.size();
+	for (int iN=0; iN<N; iN++)
+	{
+		if (densityFunctions[iN]->get_name() == GEOMETRIC)
+		{
+			densityFunctions[iN]->update(gamma[iN]);
+		}
+		if (is_tied_density(densityFunctions[iN]))
+		{
+			densityFunctions[iN]->update_constrained(gamma, iN, N);
+			set_tied_densities(densityFunctions, iN);
+			break;
+		}
+	}
+}
+
+void update_tied_densities_from_histogram(std::vector<Density*>& densityFunctions, double** histogram, int max_obs)
+{
+	// Same as update_tied_densities(), but with posteriors aggregated per observed value in histogram[iN][j]
+	int N = densityFunctions.size();
+	for (int iN=0; iN<N; iN++)
+	{
+		if (densityFunctions[iN]->get_name() == GEOMETRIC)
+		{
+			densityFunctions[iN]->update_from_histogram(histogram[iN], max_obs);
+		}
+		if (is_tied_density(densityFunctions[iN]))
+		{
+			densityFunctions[iN]->update_constrained_from_histogram(histogram, max_obs, iN, N);
+			set_tied_densities(densityFunctions, iN);
+			break;
+		}
+	}
+}
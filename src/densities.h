@@ -5,23 +5,31 @@
 #define DENSITIES_H
 
 #include "utility.h" // //FILE_LOG(), intMax()
+#include "specfun.h" // lxfactorial_table(), lgamma_table(), digamma_table(), trigamma_table()
 #include <cmath>
 #include <Rmath.h> // dnorm(), dnbinom() and digamma() etc.
 #include <vector> // storing density functions in MVCopula
 
 enum whichvariate {UNIVARIATE, MULTIVARIATE};
-enum DensityName {ZERO_INFLATION, NORMAL, NEGATIVE_BINOMIAL, GEOMETRIC, POISSON, BINOMIAL, OTHER};
+enum DensityName {ZERO_INFLATION, NORMAL, NEGATIVE_BINOMIAL, GEOMETRIC, POISSON, BINOMIAL, ZERO_INFLATED_NEGATIVE_BINOMIAL, OTHER};
 
 class Density
 {
 	public:
 		// Constructor and Destructor
+		Density() : version(0) {};
 		virtual ~Density() {};
 		// Methods
 		virtual void calc_logdensities(double*) {};
 		virtual void calc_densities(double*) {};
+		virtual void calc_logdensities_per_read(double*, int) {};
+		virtual void calc_densities_per_read(double*, int) {};
+		virtual void calc_cdf_per_read(double*, int) {};
 		virtual void update(double*) {}; 
 		virtual void update_constrained(double**, int, int) {};
+		virtual void update_from_histogram(double*, int) {};
+		virtual void update_constrained_from_histogram(double**, int, int, int) {};
+		virtual void set_observations(int*, int) {};
 		// Getter and Setter
 		virtual DensityName get_name() { return(OTHER); };
 		virtual void set_name(DensityName) {};
@@ -29,6 +37,10 @@ class Density
 		virtual void set_mean(double) {};
 		virtual double get_variance() { return(0); };
 		virtual void set_variance (double) {};
+		int get_version() { return(this->version); };
+
+	protected:
+		int version; ///< incremented whenever the parameters change, so that computed densities can be reused
 
 };  
 
@@ -43,7 +55,9 @@ class Normal : public Density
 		// Methods
 		void calc_densities(double* density);
 		void calc_logdensities(double* logdensity);
+		void calc_logdensities_per_read(double* logdens_per_read, int max_obs);
 		void update(double* weights);
+		void set_observations(int* observations, int T);
 
 		// Getter and Setter
 		DensityName get_name();
@@ -77,8 +91,14 @@ class Poisson : public Density
 		void set_name(DensityName name);
 		void calc_densities(double* density);
 		void calc_logdensities(double* logdensity);
+		void calc_logdensities_per_read(double* logdens_per_read, int max_obs);
+		void calc_densities_per_read(double* dens_per_read, int max_obs);
+		void calc_cdf_per_read(double* cdf_per_read, int max_obs);
 		void update(double* weights);
 		void update_constrained(double** weights, int fromState, int toState);
+		void update_from_histogram(double* weights, int max_obs);
+		void update_constrained_from_histogram(double** weights, int max_obs, int fromState, int toState);
+		void set_observations(int* observations, int T);
 
 		// Getter and Setter
 		double get_mean();
@@ -96,7 +116,7 @@ class Poisson : public Density
 // 		double mean; ///< mean of the poisson
 // 		double variance; ///< variance of the poisson
 		int max_obs; ///< maximum observation
-		double* lxfactorials; ///< vector of precomputed factorials log(x!)
+		const double* lxfactorials; ///< vector of precomputed factorials log(x!), shared between all densities
 
 };
 
@@ -113,8 +133,15 @@ class NegativeBinomial : public Density
 		void set_name(DensityName name);
 		void calc_densities(double* density);
 		void calc_logdensities(double* logdensity);
+		void calc_logdensities_per_read(double* logdens_per_read, int max_obs);
+		void calc_densities_per_read(double* dens_per_read, int max_obs);
+		static void calc_densities_per_read(NegativeBinomial** members, int num_members, double** dens_per_read, int max_obs);
+		void calc_cdf_per_read(double* cdf_per_read, int max_obs);
 		void update(double* weights);
 		void update_constrained(double** weights, int fromState, int toState);
+		void update_from_histogram(double* weights, int max_obs);
+		void update_constrained_from_histogram(double** weights, int max_obs, int fromState, int toState);
+		void set_observations(int* observations, int T);
 		double fsize(double mean, double variance);
 		double fprob(double mean, double variance);
 		double fmean(double size, double prob);
@@ -138,7 +165,7 @@ class NegativeBinomial : public Density
 		double mean; ///< mean of the negative binomial
 		double variance; ///< variance of the negative binomial
 		int max_obs; ///< maximum observation
-		double* lxfactorials; ///< vector of precomputed factorials log(x!)
+		const double* lxfactorials; ///< vector of precomputed factorials log(x!), shared between all densities
 
 };
 
@@ -155,8 +182,14 @@ class Binomial : public Density
 		void set_name(DensityName name);
 		void calc_densities(double* density);
 		void calc_logdensities(double* logdensity);
+		void calc_logdensities_per_read(double* logdens_per_read, int max_obs);
+		void calc_densities_per_read(double* dens_per_read, int max_obs);
+		void calc_cdf_per_read(double* cdf_per_read, int max_obs);
 		void update(double* weights);
 		void update_constrained(double** weights, int fromState, int toState);
+		void update_from_histogram(double* weights, int max_obs);
+		void update_constrained_from_histogram(double** weights, int max_obs, int fromState, int toState);
+		void set_observations(int* observations, int T);
 		double fsize(double mean, double variance);
 		double fprob(double mean, double variance);
 		double fmean(double size, double prob);
@@ -180,7 +213,50 @@ class Binomial : public Density
 // 		double mean; ///< mean of the  binomial
 // 		double variance; ///< variance of the  binomial
 		int max_obs; ///< maximum observation
-// 		double* lxfactorials; ///< vector of precomputed factorials log(x!)
+		const double* lxfactorials; ///< vector of precomputed factorials log(x!), shared between all densities
+
+};
+
+
+class ZeroInflatedNegativeBinomial : public Density
+{
+	public:
+		// Constructor and Destructor
+		ZeroInflatedNegativeBinomial(int* observations, int T, double w, double size, double prob);
+		~ZeroInflatedNegativeBinomial();
+
+		// Methods
+		DensityName get_name();
+		void set_name(DensityName name);
+		void calc_densities(double* density);
+		void calc_logdensities(double* logdensity);
+		void calc_logdensities_per_read(double* logdens_per_read, int max_obs);
+		void calc_densities_per_read(double* dens_per_read, int max_obs);
+		void calc_cdf_per_read(double* cdf_per_read, int max_obs);
+		void update(double* weights);
+		void update_constrained(double** weights, int fromState, int toState);
+		void update_from_histogram(double* weights, int max_obs);
+		void update_constrained_from_histogram(double** weights, int max_obs, int fromState, int toState);
+		void set_observations(int* observations, int T);
+
+		// Getter and Setter
+		double get_mean();
+		void set_mean(double mean);
+		double get_variance();
+		void set_variance(double variance);
+		double get_size();
+		double get_prob();
+		double get_w();
+		void set_w(double w);
+
+	private:
+		// Member variables
+		DensityName name; ///< name of the distribution
+		int T; ///< length of observation vector
+		int* obs; ///< vector [T] of observations
+		double w; ///< weight of the zero-inflation
+		NegativeBinomial nbinom; ///< negative binomial component, mean and variance refer to this component
+		int max_obs; ///< maximum observation
 
 };
 
@@ -197,7 +273,11 @@ class ZeroInflation : public Density
 		void set_name(DensityName name);
 		void calc_densities(double* density);
 		void calc_logdensities(double* logdensity);
+		void calc_logdensities_per_read(double* logdens_per_read, int max_obs);
+		void calc_densities_per_read(double* dens_per_read, int max_obs);
+		void calc_cdf_per_read(double* cdf_per_read, int max_obs);
 		void update(double* weights);
+		void set_observations(int* observations, int T);
 
 		// Getter and Setter
 		double get_mean();
@@ -224,7 +304,12 @@ class Geometric : public Density
 		void set_name(DensityName name);
 		void calc_densities(double* density);
 		void calc_logdensities(double* logdensity);
+		void calc_logdensities_per_read(double* logdens_per_read, int max_obs);
+		void calc_densities_per_read(double* dens_per_read, int max_obs);
+		void calc_cdf_per_read(double* cdf_per_read, int max_obs);
 		void update(double* weights);
+		void update_from_histogram(double* weights, int max_obs);
+		void set_observations(int* observations, int T);
 		double fprob(double mean, double variance);
 		double fmean(double prob);
 		double fvariance(double prob);
@@ -253,9 +338,14 @@ class MVCopulaApproximation : public Density {
 	public:
 		// Constructor and Destructor
 		MVCopulaApproximation(int** multiobservations, int T, std::vector<Density*> marginals, double* cor_matrix_inv, double cor_matrix_determinant);
+		MVCopulaApproximation(int** multiobservations, int T, std::vector<const double*> dens_per_read, std::vector<const double*> z_per_read, double* cor_matrix_inv, double cor_matrix_determinant);
 		~MVCopulaApproximation();
 	
 		// Methods
+		void calc_densities(double* density);
+		void calc_densities(double* density, int tstart, int tend);
+		static void tabulate_marginal(Density* marginal, int max_obs, std::vector<double>& dens_per_read, std::vector<double>& z_per_read);
+		static void calc_zvalues_per_read(Density* marginal, double* z_per_read, int max_obs);
 
 		// Getters and Setters
 		DensityName get_name();
@@ -267,10 +357,18 @@ class MVCopulaApproximation : public Density {
 		int Nmod; ///< number of modifications
 		int** multi_obs; ///< matrix [Nmod x T] of observations
 		int T; ///< length of observation vector
-		std::vector<Density*> marginals; ///< vector [Nmod] of marginal distributions
+		std::vector<Density*> marginals; ///< vector [Nmod] of marginal distributions, empty if the tables of the marginals are shared
 		double* cor_matrix_inv; ///< vector with elements of the inverse of the correlation matrix
 		double cor_matrix_determinant; ///< determinant of the correlation matrix
+		std::vector<std::vector<double> > tables; ///< vector [2*Nmod] of the densities and z-values of the own marginals for each observed value
+		std::vector<const double*> dens_per_read; ///< vector [Nmod] of marginal densities for each observed value
+		std::vector<const double*> z_per_read; ///< vector [Nmod] of z-values qnorm(CDF) of the marginals for each observed value
 };
 
 
+// Updates of the copy-number states, where the dependent (negative) binomial states are tied to the first of them (e.g. '1-somy')
+void update_tied_densities(std::vector<Density*>& densityFunctions, double** gamma);
+void update_tied_densities_from_histogram(std::vector<Density*>& densityFunctions, double** histogram, int max_obs);
+
+
 #endif
@@ -0,0 +1,441 @@
+#ifndef HMMCORE_H
+#define HMMCORE_H
+
+#include "utility.h"
+#include "specfun.h" // exp_vec(), log_vec()
+#include <cmath>
+#include <vector>
+#include <limits> // numeric_limits
+
+// ============================================================
+// Forward-backward recursions of the HMM, templated on a numeric policy
+// ============================================================
+
+// The recursions are written once in ForwardBackward<Policy>. Both the forward variables alpha and
+// the backward variables beta are divided by scaling factors per time point: alpha[t] sums to 1
+// (or has maximum 1 in log blocks, except for the last time point) and the log scaling factors sum
+// to the loglikelihood, beta[t] is divided by the same factors and therefore of order 1. Every
+// time step converts the stored variables of the previous step into a linear vector, multiplies it
+// with the transition matrix and stores the result again.
+// The variables are stored in blocks of time points, each block either linear or as logarithms:
+//   ScaledPolicy<real_t>: linear blocks stored as real_t (double or float). A block in which the
+//                         scaling factors or the backward variables approach the limits of the
+//                         type is recomputed with logarithms, the other blocks stay linear. Log
+//                         blocks read the densities that underflowed to zero from the log-densities
+//                         given with set_logdensities().
+//   LogPolicy:            all blocks as logarithms, the emission densities are logarithms as well.
+// The policy is fixed per instantiation, so the hot loops are inlined. ScaleHMM chooses the
+// instantiation at runtime through ForwardBackwardBase with one virtual call per recursion.
+
+enum whichengine {SCALED_DOUBLE, SCALED_FLOAT, LOG_SPACE};
+
+template <typename real_t>
+struct ScaledPolicy
+{
+	typedef real_t value_type;
+	static const bool always_log = false;
+	static const bool log_densities = false;
+	static inline double density(double** densities, int iN, int t) { return densities[iN][t]; }
+	// Densities that underflowed to zero are read from the log-densities if they are given
+	static inline double logdensity(double** densities, double** logdensities, int iN, int t) { return (densities[iN][t] > 0.0 || logdensities == NULL) ? log(densities[iN][t]) : logdensities[iN][t]; }
+	// Largest backward variable and inverse of the smallest scaling factor of a linear block, leaves room for the products in the recursions
+	static inline double max_linear() { return sqrt((double)std::numeric_limits<real_t>::max()); }
+};
+
+struct LogPolicy
+{
+	typedef double value_type;
+	static const bool always_log = true;
+	static const bool log_densities = true;
+	static inline double density(double** logdensities, int iN, int t) { return exp(logdensities[iN][t]); }
+	static inline double logdensity(double** logdensities, double**, int iN, int t) { return logdensities[iN][t]; }
+	static inline double max_linear() { return 0.0; }
+};
+
+class ForwardBackwardBase
+{
+	public:
+		virtual ~ForwardBackwardBase() {}
+		virtual bool log_densities() = 0; ///< true if the recursions expect log-densities
+		virtual void set_logdensities(double** logdensities) = 0; ///< matrix [N x T] of log-densities for the densities that underflowed to zero, NULL if there are none
+		// densities and gamma are matrices [N x T], A is [N x N], T can be less than the allocated length
+		virtual void forward(double** A, const double* proba, double** densities, int T) = 0;
+		virtual void backward(double** A, double** densities, int T) = 0;
+		virtual double loglikelihood(int T) = 0;
+		virtual void calc_sumgamma(double** gamma, double* sumgamma, int T, int num_threads) = 0;
+		virtual void calc_sumxi(double** A, double** densities, double** sumxi, int T, int num_threads) = 0;
+};
+
+template <class Policy>
+class ForwardBackward : public ForwardBackwardBase
+{
+	typedef typename Policy::value_type value_type;
+
+	public:
+		ForwardBackward(int Tmax, int N) : N(N), alpha((size_t)Tmax * N), beta((size_t)Tmax * N), scale(Tmax), logscale(Tmax), alpha_log(Tmax / BLOCK_SIZE + 1), beta_log(Tmax / BLOCK_SIZE + 1), work1(N), work2(N), logdensities(NULL) {}
+
+		bool log_densities()
+		{
+			return Policy::log_densities;
+		}
+
+		void set_logdensities(double** logdensities)
+		{
+			this->logdensities = logdensities;
+		}
+
+		void forward(double** A, const double* proba, double** densities, int T)
+		{
+			//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+			for (int b=0; b*BLOCK_SIZE<T; b++)
+			{
+				int t0 = b * BLOCK_SIZE;
+				int t1 = std::min(T, t0 + BLOCK_SIZE);
+				// The representation of the block is set before its time points are computed, they read the previous one
+				this->alpha_log[b] = Policy::always_log;
+				if (Policy::always_log || !this->forward_block<false>(A, proba, densities, t0, t1, T))
+				{
+					//FILE_LOG(logDEBUG1) << "forward(): block " << b << " in log space";
+					this->alpha_log[b] = true;
+					this->forward_block<true>(A, proba, densities, t0, t1, T);
+				}
+			}
+		}
+
+		void backward(double** A, double** densities, int T)
+		{
+			//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+			for (int b=(T-1)/BLOCK_SIZE; b>=0; b--)
+			{
+				int t0 = b * BLOCK_SIZE;
+				int t1 = std::min(T, t0 + BLOCK_SIZE);
+				this->beta_log[b] = Policy::always_log;
+				if (Policy::always_log || !this->backward_block<false>(A, densities, t0, t1, T))
+				{
+					//FILE_LOG(logDEBUG1) << "backward(): block " << b << " in log space";
+					this->beta_log[b] = true;
+					this->backward_block<true>(A, densities, t0, t1, T);
+				}
+			}
+		}
+
+		double loglikelihood(int T)
+		{
+			double logP = 0.0;
+			for (int t=0; t<T; t++)
+			{
+				logP += this->get_logscale(t);
+			}
+			return logP;
+		}
+
+		void calc_sumgamma(double** gamma, double* sumgamma, int T, int num_threads)
+		{
+			//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+			// Compute the gammas (posteriors), every time point is independent
+			#pragma omp parallel num_threads(num_threads)
+			{
+				std::vector<double> g(this->N);
+				#pragma omp for
+				for (int t=0; t<T; t++)
+				{
+					const value_type* a = this->alpha_row(t);
+					const value_type* b = this->beta_row(t);
+					bool alog = this->alpha_log[t / BLOCK_SIZE], blog = this->beta_log[t / BLOCK_SIZE];
+					if (!alog && !blog)
+					{
+						for (int iN=0; iN<this->N; iN++) g[iN] = (double)a[iN] * b[iN];
+					}
+					else
+					{
+						for (int iN=0; iN<this->N; iN++) g[iN] = (alog ? (double)a[iN] : log((double)a[iN])) + (blog ? (double)b[iN] : log((double)b[iN]));
+						exp_vec(&g[0], this->N, &g[0]);
+					}
+					for (int iN=0; iN<this->N; iN++)
+					{
+						gamma[iN][t] = g[iN];
+					}
+				}
+			}
+			// sumgamma goes only until T-1
+			for (int iN=0; iN<this->N; iN++)
+			{
+				double sum = 0.0;
+				for (int t=0; t<T-1; t++)
+				{
+					sum += gamma[iN][t];
+				}
+				sumgamma[iN] = sum;
+			}
+		}
+
+		void calc_sumxi(double** A, double** densities, double** sumxi, int T, int num_threads)
+		{
+			//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+			// xi[t][iN][jN] = alpha[t][iN] * A[iN][jN] * densities[jN][t+1] * beta[t+1][jN] / scale[t+1], A is multiplied in after the sum over t
+			// Time points are summed in blocks whose partial sums are added in a fixed order, so that the result does not depend on the number of threads
+			const int N2 = this->N * this->N;
+			const int sum_block_size = std::max(1024, (T-1) / 64 + 1);
+			const int num_sum_blocks = (T-1 + sum_block_size - 1) / sum_block_size;
+			std::vector<double> partial((size_t)num_sum_blocks * N2, 0.0);
+			#pragma omp parallel num_threads(num_threads)
+			{
+				std::vector<double> wa(this->N), wb(this->N);
+				#pragma omp for schedule(dynamic)
+				for (int b=0; b<num_sum_blocks; b++)
+				{
+					double* sum = &partial[(size_t)b * N2];
+					int tend = std::min(T-1, (b+1) * sum_block_size);
+					for (int t=b*sum_block_size; t<tend; t++)
+					{
+						double shift_alpha = 0.0, shift_beta = 0.0;
+						if (this->alpha_linear(t))
+						{
+							const value_type* a = this->alpha_row(t);
+							for (int iN=0; iN<this->N; iN++) wa[iN] = a[iN];
+						}
+						else shift_alpha = this->load_alpha(t, &wa[0]);
+						if (this->emitted_beta_linear(t+1))
+						{
+							const value_type* b = this->beta_row(t+1);
+							const double s = this->scale[t+1];
+							for (int jN=0; jN<this->N; jN++) wb[jN] = Policy::density(densities, jN, t+1) * b[jN] / s;
+						}
+						else shift_beta = this->load_emitted_beta(t+1, densities, &wb[0]);
+						double factor = (shift_alpha == 0.0 && shift_beta == 0.0) ? 1.0 : exp(shift_alpha + shift_beta);
+						for (int iN=0; iN<this->N; iN++)
+						{
+							const double a = wa[iN] * factor;
+							double* sum_i = sum + iN * this->N;
+							for (int jN=0; jN<this->N; jN++)
+							{
+								sum_i[jN] += a * wb[jN];
+							}
+						}
+					}
+				}
+			}
+			for (int iN=0; iN<this->N; iN++)
+			{
+				for (int jN=0; jN<this->N; jN++)
+				{
+					double sum = 0.0;
+					for (int b=0; b<num_sum_blocks; b++)
+					{
+						sum += partial[(size_t)b * N2 + iN * this->N + jN];
+					}
+					sumxi[iN][jN] = sum * A[iN][jN];
+				}
+			}
+		}
+
+	private:
+		static const int BLOCK_SIZE = 256; ///< number of time points that are switched to logarithms together
+		int N; ///< number of states
+		std::vector<value_type> alpha; ///< matrix [Tmax x N] of normalized forward variables
+		std::vector<value_type> beta; ///< matrix [Tmax x N] of backward variables, divided by the scaling factors
+		std::vector<double> scale; ///< vector [Tmax] of scaling factors of the forward variables in linear blocks
+		std::vector<double> logscale; ///< vector [Tmax] of log scaling factors of the forward variables in log blocks
+		std::vector<char> alpha_log; ///< vector [number of blocks] of flags for blocks of alpha stored as logarithms
+		std::vector<char> beta_log; ///< vector [number of blocks] of flags for blocks of beta stored as logarithms
+		std::vector<double> work1; ///< vector [N] of temporary values in the recursions
+		std::vector<double> work2; ///< vector [N] of temporary values in the recursions
+		double** logdensities; ///< matrix [N x T] of log-densities for the densities that underflowed to zero, NULL if there are none
+
+		inline value_type* alpha_row(int t) { return &this->alpha[(size_t)t * this->N]; }
+		inline value_type* beta_row(int t) { return &this->beta[(size_t)t * this->N]; }
+		inline double get_logscale(int t) { return this->alpha_log[t / BLOCK_SIZE] ? this->logscale[t] : log(this->scale[t]); }
+
+		// The callers copy linear rows themselves and call the load functions only for rows stored as logarithms, which keeps the linear loops inlined
+		inline bool alpha_linear(int t) { return !Policy::always_log && !this->alpha_log[t / BLOCK_SIZE]; }
+		inline bool emitted_beta_linear(int t) { return !Policy::always_log && !this->alpha_log[t / BLOCK_SIZE] && !this->beta_log[t / BLOCK_SIZE]; }
+
+		// Linear vector w[N] of alpha[t], returns the factored out log-scale
+		double load_alpha(int t, double* w)
+		{
+			const value_type* row = this->alpha_row(t);
+			// log-sum-exp: the maximum is factored out and the remainder exponentiated in one vectorized call
+			double shift = row[0];
+			for (int iN=1; iN<this->N; iN++) if (row[iN] > shift) shift = row[iN];
+			for (int iN=0; iN<this->N; iN++) w[iN] = row[iN] - shift;
+			exp_vec(w, this->N, w);
+			return shift;
+		}
+
+		// Linear vector w[jN] = densities[jN][t] * beta[t][jN] / scale[t], returns the factored out log-scale
+		double load_emitted_beta(int t, double** densities, double* w)
+		{
+			const value_type* row = this->beta_row(t);
+			bool blog = Policy::always_log || this->beta_log[t / BLOCK_SIZE];
+			for (int jN=0; jN<this->N; jN++) w[jN] = Policy::logdensity(densities, this->logdensities, jN, t) + (blog ? (double)row[jN] : log((double)row[jN])) - this->get_logscale(t);
+			double shift = w[0];
+			for (int jN=1; jN<this->N; jN++) if (w[jN] > shift) shift = w[jN];
+			for (int jN=0; jN<this->N; jN++) w[jN] -= shift;
+			exp_vec(w, this->N, w);
+			return shift;
+		}
+
+		// alpha[t] for t0 <= t < t1, returns false if a linear block approaches underflow
+		template <bool LOG>
+		bool forward_block(double** A, const double* proba, double** densities, int t0, int t1, int T)
+		{
+			const int N = this->N; // local copy, the member would be reloaded after every store through row and h
+			double* w = &this->work1[0];
+			double* h = &this->work2[0];
+			const double min_scale = 1.0 / Policy::max_linear();
+			for (int t=t0; t<t1; t++)
+			{
+				// h[iN] = sum_jN alpha[t-1][jN] * A[jN][iN], summed row by row of A so that the inner loop is contiguous
+				double shift = 0.0;
+				if (t == 0)
+				{
+					for (int iN=0; iN<N; iN++) h[iN] = proba[iN];
+				}
+				else
+				{
+					// Inside the block the previous row has the representation of the block
+					if ((t > t0) ? !LOG : this->alpha_linear(t-1))
+					{
+						const value_type* a = this->alpha_row(t-1);
+						for (int iN=0; iN<N; iN++) w[iN] = a[iN];
+					}
+					else shift = this->load_alpha(t-1, w);
+					for (int iN=0; iN<N; iN++) h[iN] = 0.0;
+					for (int jN=0; jN<N; jN++)
+					{
+						const double wj = w[jN];
+						const double* Aj = A[jN];
+						for (int iN=0; iN<N; iN++)
+						{
+							h[iN] += wj * Aj[iN];
+						}
+					}
+				}
+				value_type* row = this->alpha_row(t);
+				if (!LOG)
+				{
+					double sum = 0.0;
+					for (int iN=0; iN<N; iN++)
+					{
+						h[iN] *= Policy::density(densities, iN, t);
+						sum += h[iN];
+					}
+					// Smaller scaling factors mean that probabilities of other states may have been lost to underflow
+					if (!(sum > min_scale)) return false;
+					for (int iN=0; iN<N; iN++) row[iN] = h[iN] / sum;
+					this->scale[t] = (shift == 0.0) ? sum : exp(shift) * sum;
+				}
+				else
+				{
+					log_vec(h, N, h);
+					for (int iN=0; iN<N; iN++) h[iN] += Policy::logdensity(densities, this->logdensities, iN, t);
+					// Dividing by the maximum is enough to stay in range and saves the exponentials
+					double lognorm = h[0];
+					for (int iN=1; iN<N; iN++) if (h[iN] > lognorm) lognorm = h[iN];
+					if (t == T-1)
+					{
+						// The last time point sums to 1, so that the scaling factors give the loglikelihood
+						for (int iN=0; iN<N; iN++) w[iN] = h[iN] - lognorm;
+						exp_vec(w, N, w);
+						double sum = 0.0;
+						for (int iN=0; iN<N; iN++) sum += w[iN];
+						lognorm += log(sum);
+					}
+					for (int iN=0; iN<N; iN++) row[iN] = h[iN] - lognorm;
+					this->logscale[t] = shift + lognorm;
+				}
+				this->check_nan(row);
+			}
+			return true;
+		}
+
+		// beta[t] for t0 <= t < t1, returns false if a linear block approaches overflow
+		template <bool LOG>
+		bool backward_block(double** A, double** densities, int t0, int t1, int T)
+		{
+			const int N = this->N;
+			double* w = &this->work1[0];
+			double* h = &this->work2[0];
+			const double max_linear = Policy::max_linear();
+			const bool inner_linear = !LOG && this->emitted_beta_linear(t0);
+			for (int t=t1-1; t>=t0; t--)
+			{
+				value_type* row = this->beta_row(t);
+				if (t == T-1)
+				{
+					for (int iN=0; iN<N; iN++) row[iN] = LOG ? 0.0 : 1.0;
+					continue;
+				}
+				// h[iN] = sum_jN A[iN][jN] * densities[jN][t+1] * beta[t+1][jN] / scale[t+1], the terms of jN are computed once per time step
+				double shift = 0.0;
+				if ((t+1 < t1) ? inner_linear : this->emitted_beta_linear(t+1))
+				{
+					const value_type* b = this->beta_row(t+1);
+					const double s = this->scale[t+1];
+					for (int jN=0; jN<N; jN++) w[jN] = Policy::density(densities, jN, t+1) * b[jN] / s;
+				}
+				else shift = this->load_emitted_beta(t+1, densities, w);
+				for (int iN=0; iN<N; iN++)
+				{
+					const double* Ai = A[iN];
+					double sum = 0.0;
+					for (int jN=0; jN<N; jN++)
+					{
+						sum += Ai[jN] * w[jN];
+					}
+					h[iN] = sum;
+				}
+				if (!LOG)
+				{
+					if (shift != 0.0)
+					{
+						const double factor = exp(shift);
+						for (int iN=0; iN<N; iN++) h[iN] *= factor;
+					}
+					double hmax = 0.0;
+					for (int iN=0; iN<N; iN++)
+					{
+						row[iN] = h[iN];
+						if (h[iN] > hmax) hmax = h[iN];
+					}
+					// Larger backward variables would overflow, all zero means that the probabilities were lost to underflow
+					if (!(hmax > 0.0 && hmax < max_linear)) return false;
+				}
+				else
+				{
+					log_vec(h, N, h);
+					for (int iN=0; iN<N; iN++) row[iN] = shift + h[iN];
+				}
+				this->check_nan(row);
+			}
+			return true;
+		}
+
+		inline void check_nan(const value_type* row)
+		{
+			for (int iN=0; iN<this->N; iN++)
+			{
+				if (std::isnan(row[iN]))
+				{
+					//FILE_LOG(logERROR) << __PRETTY_FUNCTION__;
+					throw nan_detected;
+				}
+			}
+		}
+};
+
+// Forward-backward recursions of the given engine for sequences of up to Tmax time points
+inline ForwardBackwardBase* new_forward_backward(whichengine engine, int Tmax, int N)
+{
+	if (engine == SCALED_FLOAT)
+	{
+		return new ForwardBackward< ScaledPolicy<float> >(Tmax, N);
+	}
+	else if (engine == LOG_SPACE)
+	{
+		return new ForwardBackward<LogPolicy>(Tmax, N);
+	}
+	return new ForwardBackward< ScaledPolicy<double> >(Tmax, N);
+}
+
+#endif // HMMCORE_H
@@ -1,27 +1,40 @@
+#include "R_interface.h" // before Rinternals.h, which it includes with R_NO_REMAP
 #include <Rinternals.h>
 #include <R_ext/Rdynload.h>
-#include "R_interface.h"
 
 
-R_NativePrimitiveArgType arg1[] = {INTSXP, INTSXP, INTSXP, INTSXP, REALSXP, REALSXP, INTSXP, INTSXP, REALSXP, REALSXP, INTSXP, REALSXP, REALSXP, REALSXP, REALSXP, INTSXP, REALSXP, REALSXP, REALSXP, REALSXP, LGLSXP, INTSXP, INTSXP, INTSXP, INTSXP, INTSXP};
-R_NativePrimitiveArgType arg2[] = {REALSXP, INTSXP, INTSXP, INTSXP, INTSXP, INTSXP, INTSXP, REALSXP, REALSXP, INTSXP, REALSXP, REALSXP, REALSXP, REALSXP, REALSXP, LGLSXP, INTSXP, INTSXP, INTSXP, INTSXP};
-R_NativePrimitiveArgType arg4[] = {INTSXP};
-R_NativePrimitiveArgType arg5[] = {REALSXP, INTSXP, INTSXP, REALSXP};
+R_NativePrimitiveArgType arg5[] = {REALSXP, INTSXP, INTSXP, INTSXP, REALSXP, INTSXP};
+R_NativePrimitiveArgType arg12[] = {INTSXP, INTSXP, INTSXP, INTSXP, REALSXP, REALSXP, LGLSXP, REALSXP};
+R_NativePrimitiveArgType arg6[] = {INTSXP, INTSXP, REALSXP, REALSXP};
+R_NativePrimitiveArgType arg7[] = {INTSXP, INTSXP, INTSXP, INTSXP, INTSXP, REALSXP, REALSXP, REALSXP, REALSXP};
+R_NativePrimitiveArgType arg8[] = {INTSXP, INTSXP, INTSXP, INTSXP, INTSXP, REALSXP, REALSXP, REALSXP, INTSXP, INTSXP, REALSXP, REALSXP, INTSXP, REALSXP};
+R_NativePrimitiveArgType arg9[] = {REALSXP, INTSXP, INTSXP, INTSXP, INTSXP, INTSXP, REALSXP, REALSXP, REALSXP};
+R_NativePrimitiveArgType arg11[] = {INTSXP, INTSXP, INTSXP, INTSXP, INTSXP, INTSXP, INTSXP, INTSXP, REALSXP, REALSXP, REALSXP, REALSXP, INTSXP, INTSXP, REALSXP, REALSXP, INTSXP, REALSXP, REALSXP, REALSXP, REALSXP, REALSXP, LGLSXP, INTSXP, INTSXP, INTSXP};
 
 static const R_CMethodDef CEntries[]  = {
-    {"C_univariate_hmm", (DL_FUNC) &univariate_hmm, 26, arg1},
-    {"C_multivariate_hmm", (DL_FUNC) &multivariate_hmm, 20, arg2},
     {"C_univariate_cleanup", (DL_FUNC) &univariate_cleanup, 0, NULL},
-    {"C_multivariate_cleanup", (DL_FUNC) &multivariate_cleanup, 1, arg4},
-    {"C_array2D_which_max", (DL_FUNC) &array2D_which_max, 4, arg5},
+    {"C_multivariate_cleanup", (DL_FUNC) &multivariate_cleanup, 0, NULL},
+    {"C_posterior_summary", (DL_FUNC) &posterior_summary, 6, arg5},
+    {"C_univariate_densities", (DL_FUNC) &univariate_densities, 8, arg12},
+    {"C_benchmark_specfun", (DL_FUNC) &benchmark_specfun, 4, arg6},
+    {"C_copula_zvalues", (DL_FUNC) &copula_zvalues, 9, arg7},
+    {"C_copula_densities", (DL_FUNC) &copula_densities, 14, arg8},
+    {"C_copula_correlations", (DL_FUNC) &copula_correlations, 9, arg9},
+    {"C_bivariate_hmms", (DL_FUNC) &bivariate_hmms, 26, arg11},
     {NULL, NULL, 0, NULL}
 };
 
+static const R_CallMethodDef CallEntries[]  = {
+    {"C_univariate_hmm", (DL_FUNC) &univariate_hmm_call, 1},
+    {"C_bivariate_hmm", (DL_FUNC) &bivariate_hmm_call, 2},
+    {NULL, NULL, 0}
+};
+
 
 extern "C" {
 void R_init_AneuFinder(DllInfo *dll)
 {
-	R_registerRoutines(dll, CEntries, NULL, NULL, NULL);
+	R_registerRoutines(dll, CEntries, CallEntries, NULL, NULL);
 	R_useDynamicSymbols(dll, FALSE);
 // 	R_forceSymbols(dll, TRUE);
 }
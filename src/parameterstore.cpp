@@ -0,0 +1,223 @@
+
+
+
+#include "parameterstore.h"
+
+// Binary layout (native byte order): magic, version, number of records and for each record
+// N, distr_type[N], size[N], prob[N], A[N x N], proba[N].
+static const char parameterstore_magic[8] = "AFPSTOR";
+static const int parameterstore_version = 1;
+
+static double median(std::vector<double> x)
+{
+	std::sort(x.begin(), x.end());
+	int n = x.size();
+	if (n % 2 == 1) return(x[n/2]);
+	return( (x[n/2-1] + x[n/2]) / 2.0 );
+}
+
+// Public =====================================================
+
+// Constructor and Destructor ---------------------------------
+ParameterStore::ParameterStore(const char* file, int max_records)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	this->file = file;
+	this->max_records = max_records;
+	this->load();
+}
+
+ParameterStore::~ParameterStore()
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+}
+
+// Methods ----------------------------------------------------
+int ParameterStore::seed(int N, int* distr_type, double* size, double* prob, double* A, double* proba)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// Collect all records for this model
+	std::vector<const ParameterRecord*> matching;
+	for (unsigned int i=0; i<this->records.size(); i++)
+	{
+		if (this->matches(this->records[i], N, distr_type)) matching.push_back(&this->records[i]);
+	}
+	int num = matching.size();
+	if (num == 0) return(0);
+
+	// The element-wise median is robust against single bad fits and preserves the tied structure of the somy states
+	std::vector<double> values(num);
+	for (int iN=0; iN<N; iN++)
+	{
+		for (int i=0; i<num; i++) values[i] = matching[i]->size[iN];
+		size[iN] = median(values);
+		for (int i=0; i<num; i++) values[i] = matching[i]->prob[iN];
+		prob[iN] = median(values);
+		for (int i=0; i<num; i++) values[i] = matching[i]->proba[iN];
+		proba[iN] = median(values);
+		for (int jN=0; jN<N; jN++)
+		{
+			for (int i=0; i<num; i++) values[i] = matching[i]->A[iN + jN*N];
+			A[iN + jN*N] = median(values);
+		}
+	}
+
+	// Medians of probabilities need not sum to one
+	double sumproba = 0;
+	for (int iN=0; iN<N; iN++)
+	{
+		sumproba += proba[iN];
+		double sumA = 0;
+		for (int jN=0; jN<N; jN++) sumA += A[iN + jN*N];
+		if (sumA > 0)
+		{
+			for (int jN=0; jN<N; jN++) A[iN + jN*N] /= sumA;
+		}
+	}
+	if (sumproba > 0)
+	{
+		for (int iN=0; iN<N; iN++) proba[iN] /= sumproba;
+	}
+	return(num);
+}
+
+void ParameterStore::record(int N, int* distr_type, double* size, double* prob, double* A, double* proba)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	ParameterRecord rec;
+	rec.distr_type.assign(distr_type, distr_type+N);
+	rec.size.assign(size, size+N);
+	rec.prob.assign(prob, prob+N);
+	rec.A.assign(A, A+N*N);
+	rec.proba.assign(proba, proba+N);
+	for (int i=0; i<N*N; i++)
+	{
+		if (!std::isfinite(rec.A[i])) return;
+	}
+	for (int iN=0; iN<N; iN++)
+	{
+		if (!std::isfinite(rec.size[iN]) || !std::isfinite(rec.prob[iN]) || !std::isfinite(rec.proba[iN])) return;
+	}
+	this->records.push_back(rec);
+
+	// Drop the oldest records of this model
+	int num = 0;
+	for (unsigned int i=0; i<this->records.size(); i++)
+	{
+		if (this->matches(this->records[i], N, distr_type)) num++;
+	}
+	for (unsigned int i=0; i<this->records.size() && num>this->max_records; )
+	{
+		if (this->matches(this->records[i], N, distr_type))
+		{
+			this->records.erase(this->records.begin()+i);
+			num--;
+		}
+		else
+		{
+			i++;
+		}
+	}
+}
+
+bool ParameterStore::save()
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// Write to a temporary file first, so that readers never see a partially written store
+	std::string tmpfile = this->file + ".tmp";
+	FILE* pFile = fopen(tmpfile.c_str(), "wb");
+	if (pFile == NULL)
+	{
+		//FILE_LOG(logWARNING) << "Could not open parameter store " << tmpfile;
+		Rprintf("Could not open parameter store %s\n", tmpfile.c_str());
+		return(false);
+	}
+	int num_records = this->records.size();
+	bool ok = true;
+	ok = ok && fwrite(parameterstore_magic, sizeof(char), 8, pFile) == 8;
+	ok = ok && fwrite(&parameterstore_version, sizeof(int), 1, pFile) == 1;
+	ok = ok && fwrite(&num_records, sizeof(int), 1, pFile) == 1;
+	for (int i=0; ok && i<num_records; i++)
+	{
+		const ParameterRecord& rec = this->records[i];
+		int N = rec.distr_type.size();
+		ok = ok && fwrite(&N, sizeof(int), 1, pFile) == 1;
+		ok = ok && fwrite(&rec.distr_type[0], sizeof(int), N, pFile) == (size_t)N;
+		ok = ok && fwrite(&rec.size[0], sizeof(double), N, pFile) == (size_t)N;
+		ok = ok && fwrite(&rec.prob[0], sizeof(double), N, pFile) == (size_t)N;
+		ok = ok && fwrite(&rec.A[0], sizeof(double), N*N, pFile) == (size_t)(N*N);
+		ok = ok && fwrite(&rec.proba[0], sizeof(double), N, pFile) == (size_t)N;
+	}
+	ok = (fclose(pFile) == 0) && ok;
+	if (!ok)
+	{
+		//FILE_LOG(logWARNING) << "Could not write parameter store " << tmpfile;
+		Rprintf("Could not write parameter store %s\n", tmpfile.c_str());
+		remove(tmpfile.c_str());
+		return(false);
+	}
+	// rename() does not overwrite existing files on Windows
+	if (rename(tmpfile.c_str(), this->file.c_str()) != 0)
+	{
+		remove(this->file.c_str());
+		if (rename(tmpfile.c_str(), this->file.c_str()) != 0)
+		{
+			//FILE_LOG(logWARNING) << "Could not write parameter store " << this->file;
+			Rprintf("Could not write parameter store %s\n", this->file.c_str());
+			return(false);
+		}
+	}
+	return(true);
+}
+
+// Private ====================================================
+
+bool ParameterStore::load()
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	this->records.clear();
+	FILE* pFile = fopen(this->file.c_str(), "rb");
+	if (pFile == NULL) return(false);
+	char magic[8];
+	int version, num_records;
+	bool ok = true;
+	ok = ok && fread(magic, sizeof(char), 8, pFile) == 8 && memcmp(magic, parameterstore_magic, 8) == 0;
+	ok = ok && fread(&version, sizeof(int), 1, pFile) == 1 && version == parameterstore_version;
+	ok = ok && fread(&num_records, sizeof(int), 1, pFile) == 1 && num_records >= 0;
+	for (int i=0; ok && i<num_records; i++)
+	{
+		ParameterRecord rec;
+		int N;
+		ok = ok && fread(&N, sizeof(int), 1, pFile) == 1 && N > 0;
+		if (!ok) break;
+		rec.distr_type.resize(N);
+		rec.size.resize(N);
+		rec.prob.resize(N);
+		rec.A.resize(N*N);
+		rec.proba.resize(N);
+		ok = ok && fread(&rec.distr_type[0], sizeof(int), N, pFile) == (size_t)N;
+		ok = ok && fread(&rec.size[0], sizeof(double), N, pFile) == (size_t)N;
+		ok = ok && fread(&rec.prob[0], sizeof(double), N, pFile) == (size_t)N;
+		ok = ok && fread(&rec.A[0], sizeof(double), N*N, pFile) == (size_t)(N*N);
+		ok = ok && fread(&rec.proba[0], sizeof(double), N, pFile) == (size_t)N;
+		if (ok) this->records.push_back(rec);
+	}
+	fclose(pFile);
+	if (!ok)
+	{
+		//FILE_LOG(logWARNING) << "Ignoring unreadable parameter store " << this->file;
+		Rprintf("Ignoring unreadable parameter store %s\n", this->file.c_str());
+		this->records.clear();
+	}
+	return(ok);
+}
+
+bool ParameterStore::matches(const ParameterRecord& rec, int N, int* distr_type)
+{
+	if ((int)rec.distr_type.size() != N) return(false);
+	for (int iN=0; iN<N; iN++)
+	{
+		if (rec.distr_type[iN] != distr_type[iN]) return(false);
+	}
+	return(true);
+}
@@ -0,0 +1,51 @@
+
+
+
+#ifndef PARAMETERSTORE_H
+#define PARAMETERSTORE_H
+
+#include <R.h> // Rprintf()
+#include <cmath>
+#include <vector>
+#include <string>
+#include <stdio.h> // fopen(), fwrite(), rename()
+#include <string.h> // memcmp()
+#include <algorithm> // sort()
+
+// ============================================================
+// Store of fitted parameters, used to seed fits of similar cells
+// ============================================================
+
+struct ParameterRecord
+{
+	std::vector<int> distr_type; ///< vector[N] of distribution types, identifies the model
+	std::vector<double> size; ///< vector[N] of size parameters
+	std::vector<double> prob; ///< vector[N] of prob parameters
+	std::vector<double> A; ///< vector[N x N] of transition probabilities (column-major as in R)
+	std::vector<double> proba; ///< vector[N] of initial probabilities
+};
+
+class ParameterStore
+{
+	public:
+		// Constructor and Destructor
+		ParameterStore(const char* file, int max_records);
+		~ParameterStore();
+
+		// Methods
+		int seed(int N, int* distr_type, double* size, double* prob, double* A, double* proba);
+		void record(int N, int* distr_type, double* size, double* prob, double* A, double* proba);
+		bool save();
+
+	private:
+		// Member variables
+		std::string file; ///< file in which the records are persisted
+		int max_records; ///< maximum number of records that are kept for each model
+		std::vector<ParameterRecord> records; ///< records of all models, oldest first
+
+		// Methods
+		bool load();
+		bool matches(const ParameterRecord& rec, int N, int* distr_type);
+};
+
+#endif
@@ -4,7 +4,7 @@
 #include "scalehmm.h"
 
 // ============================================================
-// Hidden Markov Model implemented with scaling strategy
+// Hidden Markov Model implemented with scaling strategy or in log space, see hmmcore.h
 // ============================================================
 
 // Public =====================================================
@@ -16,22 +16,29 @@ ScaleHMM::ScaleHMM(int T, int N)
 	//FILE_LOG(logDEBUG2) << "Initializing univariate ScaleHMM";
 	this->xvariate = UNIVARIATE;
 	this->T = T;
+	this->Tmax = T;
 	this->N = N;
-	this->A = CallocDoubleMatrix(N, N);
-	this->scalefactoralpha = (double*) Calloc(T, double);
-	this->scalealpha = CallocDoubleMatrix(T, N);
-	this->scalebeta = CallocDoubleMatrix(T, N);
-	this->densities = CallocDoubleMatrix(N, T);
-// 	this->tdensities = CallocDoubleMatrix(T, N);
-	this->proba = (double*) Calloc(N, double);
-	this->gamma = CallocDoubleMatrix(N, T);
-	this->sumgamma = (double*) Calloc(N, double);
-	this->sumxi = CallocDoubleMatrix(N, N);
+	this->A = newDoubleMatrix(N, N);
+	this->engine = SCALED_DOUBLE;
+	this->fb = new_forward_backward(this->engine, T, N);
+	this->densities = newDoubleMatrix(N, T);
+	this->logdensities = NULL;
+// 	this->tdensities = newDoubleMatrix(T, N);
+	this->proba = new double[N]();
+	this->gamma = newDoubleMatrix(N, T);
+	this->sumgamma = new double[N]();
+	this->sumxi = newDoubleMatrix(N, N);
 	this->logP = -INFINITY;
 	this->dlogP = INFINITY;
 	this->sumdiff_state_last = 0;
 	this->sumdiff_posterior = 0.0;
 // 	this->use_tdens = false;
+	this->checkpoint_interval = 0;
+	this->checkpoint_fingerprint = 0;
+	this->obs = NULL;
+	this->max_obs = 0;
+	this->num_threads = 1;
+	this->quiet = false;
 
 }
 
@@ -42,76 +49,80 @@ ScaleHMM::ScaleHMM(int T, int N, int Nmod, double** densities)
 	//FILE_LOG(logDEBUG2) << "Initializing multivariate ScaleHMM";
 	this->xvariate = MULTIVARIATE;
 	this->T = T;
+	this->Tmax = T;
 	this->N = N;
-	this->A = CallocDoubleMatrix(N, N);
-	this->scalefactoralpha = (double*) Calloc(T, double);
-	this->scalealpha = CallocDoubleMatrix(T, N);
-	this->scalebeta = CallocDoubleMatrix(T, N);
+	this->A = newDoubleMatrix(N, N);
+	this->engine = SCALED_DOUBLE;
+	this->fb = new_forward_backward(this->engine, T, N);
 	this->densities = densities;
-	this->proba = (double*) Calloc(N, double);
-	this->gamma = CallocDoubleMatrix(N, T);
-	this->sumgamma = (double*) Calloc(N, double);
-	this->sumxi = CallocDoubleMatrix(N, N);
+	this->logdensities = NULL;
+	this->proba = new double[N]();
+	this->gamma = newDoubleMatrix(N, T);
+	this->sumgamma = new double[N]();
+	this->sumxi = newDoubleMatrix(N, N);
 	this->logP = -INFINITY;
 	this->dlogP = INFINITY;
 	this->Nmod = Nmod;
+	this->checkpoint_interval = 0;
+	this->checkpoint_fingerprint = 0;
+	this->obs = NULL;
+	this->max_obs = 0;
+	this->num_threads = 1;
+	this->quiet = false;
 
 }
 
 ScaleHMM::~ScaleHMM()
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
-	FreeDoubleMatrix(this->A, this->N);
-	Free(this->scalefactoralpha);
-	FreeDoubleMatrix(this->scalealpha, this->T);
-	FreeDoubleMatrix(this->scalebeta, this->T);
-// 	FreeDoubleMatrix(this->tdensities, this->T);
-	FreeDoubleMatrix(this->gamma, this->N);
-	FreeDoubleMatrix(this->sumxi, this->N);
-	Free(this->proba);
-	Free(this->sumgamma);
+	deleteDoubleMatrix(this->A, this->N);
+	delete this->fb;
+// 	deleteDoubleMatrix(this->tdensities, this->T);
+	deleteDoubleMatrix(this->gamma, this->N);
+	deleteDoubleMatrix(this->sumxi, this->N);
+	delete[] this->proba;
+	delete[] this->sumgamma;
 	if (this->xvariate == UNIVARIATE)
 	{
-		FreeDoubleMatrix(this->densities, this->N);
+		deleteDoubleMatrix(this->densities, this->N);
+		if (this->logdensities != NULL) deleteDoubleMatrix(this->logdensities, this->N);
 		for (int iN=0; iN<this->N; iN++)
 		{
 			//FILE_LOG(logDEBUG1) << "Deleting density functions"; 
 			delete this->densityFunctions[iN];
 		}
 	}
+	else if (this->xvariate == MULTIVARIATE)
+	{
+		// Copulas and their marginals, both only exist if the densities are computed from the copula
+		for (unsigned int iN=0; iN<this->densityFunctions.size(); iN++)
+		{
+			delete this->densityFunctions[iN];
+		}
+		for (unsigned int imod=0; imod<this->marginals.size(); imod++)
+		{
+			for (unsigned int i=0; i<this->marginals[imod].size(); i++)
+			{
+				delete this->marginals[imod][i];
+			}
+		}
+	}
 }
 
 // Methods ----------------------------------------------------
 void ScaleHMM::initialize_transition_probs(double* initial_A, bool use_initial_params)
 {
 
-	if (use_initial_params)
+	if (!use_initial_params)
 	{
-		for (int iN=0; iN<this->N; iN++)
-		{
-			for (int jN=0; jN<this->N; jN++)
-			{
-				// convert from vector to matrix representation
-				this->A[jN][iN] = initial_A[iN*this->N + jN];
-			}
-		}
+		ScaleHMM::default_transition_probs(initial_A, this->N);
 	}
-	else
+	for (int iN=0; iN<this->N; iN++)
 	{
-		double self = 0.9;
-// 		self = 1.0 / this->N; // set to uniform
-		double other = (1.0 - self) / (this->N - 1.0);
-		for (int iN=0; iN<this->N; iN++)
+		for (int jN=0; jN<this->N; jN++)
 		{
-			for (int jN=0; jN<this->N; jN++)
-			{
-				if (iN == jN)
-					this->A[iN][jN] = self;
-				else
-					this->A[iN][jN] = other;
-				// Save value to initial A
-				initial_A[jN*this->N + iN] = this->A[iN][jN];
-			}
+			// convert from vector to matrix representation
+			this->A[jN][iN] = initial_A[iN*this->N + jN];
 		}
 	}
 	
@@ -120,45 +131,72 @@ void ScaleHMM::initialize_transition_probs(double* initial_A, bool use_initial_p
 void ScaleHMM::initialize_proba(double* initial_proba, bool use_initial_params)
 {
 
-	if (use_initial_params)
+	if (!use_initial_params)
 	{
-		for (int iN=0; iN<this->N; iN++)
-		{
-			this->proba[iN] = initial_proba[iN];
-		}
+		ScaleHMM::default_proba(initial_proba, this->N);
 	}
-	else
+	for (int iN=0; iN<this->N; iN++)
 	{
-		for (int iN=0; iN<this->N; iN++)
+		this->proba[iN] = initial_proba[iN];
+	}
+
+}
+
+void ScaleHMM::default_transition_probs(double* initial_A, int N)
+{
+
+	double self = 0.9;
+// 	self = 1.0 / N; // set to uniform
+	double other = (1.0 - self) / (N - 1.0);
+	for (int iN=0; iN<N; iN++)
+	{
+		for (int jN=0; jN<N; jN++)
 		{
-			this->proba[iN] = (double)1/this->N;
-			// Save value to initial proba
-			initial_proba[iN] = this->proba[iN];
+			if (iN == jN)
+				initial_A[jN*N + iN] = self;
+			else
+				initial_A[jN*N + iN] = other;
 		}
 	}
 
 }
 
+void ScaleHMM::default_proba(double* initial_proba, int N)
+{
+
+	for (int iN=0; iN<N; iN++)
+	{
+		initial_proba[iN] = (double)1/N;
+	}
+
+}
+
 void ScaleHMM::baumWelch()
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
 
-	R_CheckUserInterrupt();
+	this->check_user_interrupt();
 	
 	if (this->xvariate == UNIVARIATE)
 	{
 		//FILE_LOG(logDEBUG1) << "Calling calc_densities() from baumWelch()";
 		try { this->calc_densities(); } catch(...) { throw; }
-		R_CheckUserInterrupt();
+		this->check_user_interrupt();
+	}
+	else if (this->marginals.size() > 0)
+	{
+		//FILE_LOG(logDEBUG1) << "Calling calc_copula_densities() from baumWelch()";
+		this->calc_copula_densities();
+		this->check_user_interrupt();
 	}
 
 	//FILE_LOG(logDEBUG1) << "Calling forward() from baumWelch()";
 	try { this->forward(); } catch(...) { throw; }
-	R_CheckUserInterrupt();
+	this->check_user_interrupt();
 
 	//FILE_LOG(logDEBUG1) << "Calling backward() from baumWelch()";
 	try { this->backward(); } catch(...) { throw; }
-	R_CheckUserInterrupt();
+	this->check_user_interrupt();
 
 	//FILE_LOG(logDEBUG1) << "Calling calc_loglikelihood() from baumWelch()";
 	this->calc_loglikelihood();
@@ -170,11 +208,11 @@ void ScaleHMM::baumWelch()
 
 	//FILE_LOG(logDEBUG1) << "Calling calc_sumxi() from baumWelch()";
 	this->calc_sumxi();
-	R_CheckUserInterrupt();
+	this->check_user_interrupt();
 
 	//FILE_LOG(logDEBUG1) << "Calling calc_sumgamma() from baumWelch()";
 	this->calc_sumgamma();
-	R_CheckUserInterrupt();
+	this->check_user_interrupt();
 
 }
 
@@ -184,13 +222,24 @@ void ScaleHMM::EM(int* maxiter, int* maxtime, double* eps)
 
 	double logPold = -INFINITY;
 	double logPnew;
-	double** gammaold = CallocDoubleMatrix(this->N, this->T);
+	double** gammaold = newDoubleMatrix(this->N, this->T);
 
 	// Parallelization settings
 // 	omp_set_nested(1);
 	
 	// measuring the time
 	this->EMStartTime_sec = time(NULL);
+	this->EMTime_real = 0;
+
+	// Continue from a previous run if a matching checkpoint exists
+	int iteration = 0;
+	this->logP_history.clear();
+	if (this->read_checkpoint(&iteration, &logPold))
+	{
+		//FILE_LOG(logINFO) << "Resuming from checkpoint " << this->checkpoint_file << " after iteration " << iteration;
+		Rprintf("Resuming from checkpoint %s after iteration %d\n", this->checkpoint_file.c_str(), iteration);
+	}
+	int iteration_start = iteration; // maxiter and maxtime apply to this run only
 
 	// Print some initial information
 	if (this->xvariate == UNIVARIATE)
@@ -205,18 +254,23 @@ void ScaleHMM::EM(int* maxiter, int* maxtime, double* eps)
 		this->print_multi_iteration(0);
 	}
 
-	R_CheckUserInterrupt();
+	this->check_user_interrupt();
 
 	// Do the Baum-Welch and updates
-	int iteration = 0;
-	while (((this->EMTime_real < *maxtime) or (*maxtime < 0)) and ((iteration < *maxiter) or (*maxiter < 0)))
+	while (((this->EMTime_real < *maxtime) or (*maxtime < 0)) and ((iteration - iteration_start < *maxiter) or (*maxiter < 0)))
 	{
 
 		iteration++;
 		
-		try { this->baumWelch(); } catch(...) { throw; }
+		try { this->baumWelch(); }
+		catch(...)
+		{
+			deleteDoubleMatrix(gammaold, this->N);
+			throw;
+		}
 		logPnew = this->logP;
 		this->dlogP = logPnew - logPold;
+		this->logP_history.push_back(logPnew);
 
 		if (this->xvariate == UNIVARIATE)
 		{
@@ -237,7 +291,7 @@ void ScaleHMM::EM(int* maxiter, int* maxtime, double* eps)
 // 			//FILE_LOG(logDEBUG) << "differences in posterior: " << dtime << " clicks";
 		}
 
-		R_CheckUserInterrupt();
+		this->check_user_interrupt();
 
 		// Print information about current iteration
 		if (this->xvariate == UNIVARIATE)
@@ -253,22 +307,25 @@ void ScaleHMM::EM(int* maxiter, int* maxtime, double* eps)
 		if((fabs(this->dlogP) < *eps) && (this->dlogP < INFINITY)) //it has converged
 		{
 			//FILE_LOG(logINFO) << "Convergence reached!\n";
-			Rprintf("Convergence reached!\n");
+			if (!this->quiet) Rprintf("Convergence reached!\n");
 			break;
 		}
 		else
 		{ // not converged
 			this->EMTime_real = difftime(time(NULL),this->EMStartTime_sec);
-			if (iteration == *maxiter)
+			if (iteration - iteration_start == *maxiter)
 			{
 				//FILE_LOG(logINFO) << "Maximum number of iterations reached!";
-				Rprintf("Maximum number of iterations reached!\n");
+				if (!this->quiet) Rprintf("Maximum number of iterations reached!\n");
+				// parameters are not yet updated, so the checkpoint reflects the previous iteration
+				this->write_checkpoint(iteration-1, logPold, this->logP_history.size()-1);
 				break;
 			}
 			else if ((this->EMTime_real >= *maxtime) and (*maxtime >= 0))
 			{
 				//FILE_LOG(logINFO) << "Exceeded maximum time!";
-				Rprintf("Exceeded maximum time!\n");
+				if (!this->quiet) Rprintf("Exceeded maximum time!\n");
+				this->write_checkpoint(iteration-1, logPold, this->logP_history.size()-1);
 				break;
 			}
 			logPold = logPnew;
@@ -308,13 +365,28 @@ void ScaleHMM::EM(int* maxiter, int* maxtime, double* eps)
 						//FILE_LOG(logERROR) << "A["<<iN<<"]["<<jN<<"] = " << A[iN][jN];
 						//FILE_LOG(logERROR) << "sumxi["<<iN<<"]["<<jN<<"] = " << sumxi[iN][jN];
 						//FILE_LOG(logERROR) << "sumgamma["<<iN<<"] = " << sumgamma[iN];
+						deleteDoubleMatrix(gammaold, this->N);
 						throw nan_detected;
 					}
 				}
 			}
 		}
 
-		if (this->xvariate == UNIVARIATE)
+		if ((this->xvariate == UNIVARIATE) && (this->segment_offsets.size() > 0))
+		{
+			this->update_densities_from_segments();
+			this->check_user_interrupt();
+		}
+		else if ((this->xvariate == UNIVARIATE) && (this->obs_values.size() > 0))
+		{
+			// Same update as below, but the histograms are summed over the encoded observations
+			double** histogram = newDoubleMatrix(this->N, this->max_obs+1);
+			this->calc_histograms(histogram);
+			this->update_densities_from_histogram(histogram, this->max_obs);
+			deleteDoubleMatrix(histogram, this->N);
+			this->check_user_interrupt();
+		}
+		else if (this->xvariate == UNIVARIATE)
 		{
 // 			clock_t clocktime = clock(), dtime;
 // 
@@ -325,51 +397,190 @@ void ScaleHMM::EM(int* maxiter, int* maxtime, double* eps)
 // 			}
 
 			// Update distribution of independent states first, set others as multiples of 'monosomy'
-			// This loop assumes that the dependent negative binomial states come last and are consecutive
-			int xsomy = 1;
+			update_tied_densities(this->densityFunctions, this->gamma);
+// 			dtime = clock() - clocktime;
+// 			//FILE_LOG(logDEBUG) << "updating distributions: " << dtime << " clicks";
+			this->check_user_interrupt();
+		}
+		else if ((this->xvariate == MULTIVARIATE) && (this->marginals.size() > 0))
+		{
+			// Marginals and correlations of the copula are estimated together with A and proba
+			this->update_copula();
+			this->check_user_interrupt();
+		}
+
+		if ((this->checkpoint_interval > 0) && (iteration % this->checkpoint_interval == 0))
+		{
+			this->write_checkpoint(iteration, logPnew, this->logP_history.size());
+		}
+
+	} /* main loop end */
+    
+    
+	//Print the last results
+	//FILE_LOG(logINFO) << "";
+	//FILE_LOG(logINFO) << "FINAL ESTIMATION RESULTS";
+// 	this->print_uni_params();
+
+	// free memory
+	deleteDoubleMatrix(gammaold, this->N);
+
+	// Return values
+	*maxiter = iteration;
+	*eps = this->dlogP;
+	this->EMTime_real = difftime(time(NULL),this->EMStartTime_sec);
+	*maxtime = this->EMTime_real;
+}
+
+void ScaleHMM::onlineEM(int* O, int* chunk_lengths, int num_chunks, double decay, int* maxiter, int* maxtime, double* eps)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+
+	int Ttotal = 0;
+	for (int c=0; c<num_chunks; c++)
+	{
+		Ttotal += chunk_lengths[c];
+	}
+	int max_obs = intMax(O, Ttotal);
+
+	// Running sufficient statistics, normalized per bin so that chunks of different length are comparable
+	double** run_sumxi = newDoubleMatrix(this->N, this->N);
+	double* run_sumgamma = new double[this->N]();
+	double* run_proba = new double[this->N]();
+	double** run_histogram = newDoubleMatrix(this->N, max_obs+1);
+	double** histogram = newDoubleMatrix(this->N, max_obs+1);
+	int num_updates = 0;
+	double logPold = -INFINITY;
+	double logPnew;
+
+	// measuring the time
+	this->EMStartTime_sec = time(NULL);
+	this->EMTime_real = 0;
+	this->sumdiff_posterior = 0.0;
+	this->print_uni_iteration(0);
+
+	this->check_user_interrupt();
+
+	// Every iteration is one pass over all chunks, with an M-step after each chunk
+	int iteration = 0;
+	while (((this->EMTime_real < *maxtime) or (*maxtime < 0)) and ((iteration < *maxiter) or (*maxiter < 0)))
+	{
+
+		iteration++;
+		logPnew = 0.0;
+		int offset = 0;
+		for (int c=0; c<num_chunks; c++)
+		{
+			int Tc = chunk_lengths[c];
+			this->set_observations(O + offset, Tc);
+			try { this->baumWelch(); }
+			catch(...)
+			{
+				deleteDoubleMatrix(run_sumxi, this->N);
+				delete[] run_sumgamma;
+				delete[] run_proba;
+				deleteDoubleMatrix(run_histogram, this->N);
+				deleteDoubleMatrix(histogram, this->N);
+				throw;
+			}
+			logPnew += this->logP;
+
+			// Blend the statistics of this chunk into the running statistics with a decaying step size
+			double stepsize = pow(num_updates+1, -decay);
+			num_updates++;
 			for (int iN=0; iN<this->N; iN++)
 			{
-				if (this->densityFunctions[iN]->get_name() == ZERO_INFLATION) {}
-				if (this->densityFunctions[iN]->get_name() == GEOMETRIC)
+				run_proba[iN] = (1-stepsize) * run_proba[iN] + stepsize * this->gamma[iN][0];
+				run_sumgamma[iN] = (1-stepsize) * run_sumgamma[iN] + stepsize * this->sumgamma[iN] / Tc;
+				for (int jN=0; jN<this->N; jN++)
 				{
-					this->densityFunctions[iN]->update(this->gamma[iN]);
+					run_sumxi[iN][jN] = (1-stepsize) * run_sumxi[iN][jN] + stepsize * this->sumxi[iN][jN] / Tc;
 				}
-				if (this->densityFunctions[iN]->get_name() == NEGATIVE_BINOMIAL)
+			}
+			// Posteriors of this chunk summed per observed value, this->max_obs is the maximum of the chunk
+			for (int iN=0; iN<this->N; iN++)
+			{
+				memset(histogram[iN], 0, (this->max_obs+1) * sizeof(double));
+			}
+			this->calc_histograms(histogram);
+			for (int iN=0; iN<this->N; iN++)
+			{
+				for (int j=0; j<=max_obs; j++)
+				{
+					run_histogram[iN][j] *= (1-stepsize);
+				}
+				for (int j=0; j<=this->max_obs; j++)
+				{
+					run_histogram[iN][j] += stepsize * histogram[iN][j] / Tc;
+				}
+			}
+
+			// Updating initial probabilities proba and transition matrix A
+			for (int iN=0; iN<this->N; iN++)
+			{
+				this->proba[iN] = run_proba[iN];
+				if (run_sumgamma[iN] > 0)
 				{
-					if (xsomy==1)
+					for (int jN=0; jN<this->N; jN++)
 					{
-						//FILE_LOG(logDEBUG1) << "mean(state="<<iN<<") = " << this->densityFunctions[iN]->get_mean() << ", var(state="<<iN<<") = " << this->densityFunctions[iN]->get_variance();
-						this->densityFunctions[iN]->update_constrained(this->gamma, iN, this->N);
-						double mean1 = this->densityFunctions[iN]->get_mean();
-						double variance1 = this->densityFunctions[iN]->get_variance();
-						//FILE_LOG(logDEBUG1) << "mean(state="<<iN<<") = " << this->densityFunctions[iN]->get_mean() << ", var(state="<<iN<<") = " << this->densityFunctions[iN]->get_variance();
-						// Set others as multiples
-						for (int jN=iN+1; jN<this->N; jN++)
+						this->A[iN][jN] = run_sumxi[iN][jN] / run_sumgamma[iN];
+						if (std::isnan(this->A[iN][jN]))
 						{
-							this->densityFunctions[jN]->set_mean(mean1 * (jN-iN+1));
-							this->densityFunctions[jN]->set_variance(variance1 * (jN-iN+1));
-							//FILE_LOG(logDEBUG1) << "mean(state="<<jN<<") = " << this->densityFunctions[jN]->get_mean() << ", var(state="<<jN<<") = " << this->densityFunctions[jN]->get_variance();
+							//FILE_LOG(logERROR) << "updating transition probabilities";
+							deleteDoubleMatrix(run_sumxi, this->N);
+							delete[] run_sumgamma;
+							delete[] run_proba;
+							deleteDoubleMatrix(run_histogram, this->N);
+							deleteDoubleMatrix(histogram, this->N);
+							throw nan_detected;
 						}
-						break;
 					}
-					xsomy++;
 				}
 			}
-// 			dtime = clock() - clocktime;
-// 			//FILE_LOG(logDEBUG) << "updating distributions: " << dtime << " clicks";
-			R_CheckUserInterrupt();
+			this->update_densities_from_histogram(run_histogram, max_obs);
+
+			offset += Tc;
+			this->check_user_interrupt();
+		}
+		this->logP = logPnew;
+		this->dlogP = logPnew - logPold;
+
+		// Print information about current iteration
+		this->print_uni_iteration(iteration);
+
+		// Check convergence
+		if((fabs(this->dlogP) < *eps) && (this->dlogP < INFINITY)) //it has converged
+		{
+			//FILE_LOG(logINFO) << "Convergence reached!\n";
+			if (!this->quiet) Rprintf("Convergence reached!\n");
+			break;
+		}
+		else
+		{ // not converged
+			this->EMTime_real = difftime(time(NULL),this->EMStartTime_sec);
+			if (iteration == *maxiter)
+			{
+				//FILE_LOG(logINFO) << "Maximum number of iterations reached!";
+				if (!this->quiet) Rprintf("Maximum number of iterations reached!\n");
+				break;
+			}
+			else if ((this->EMTime_real >= *maxtime) and (*maxtime >= 0))
+			{
+				//FILE_LOG(logINFO) << "Exceeded maximum time!";
+				if (!this->quiet) Rprintf("Exceeded maximum time!\n");
+				break;
+			}
+			logPold = logPnew;
 		}
 
 	} /* main loop end */
-    
-    
-	//Print the last results
-	//FILE_LOG(logINFO) << "";
-	//FILE_LOG(logINFO) << "FINAL ESTIMATION RESULTS";
-// 	this->print_uni_params();
 
 	// free memory
-	FreeDoubleMatrix(gammaold, this->N);
+	deleteDoubleMatrix(run_sumxi, this->N);
+	delete[] run_sumgamma;
+	delete[] run_proba;
+	deleteDoubleMatrix(run_histogram, this->N);
+	deleteDoubleMatrix(histogram, this->N);
 
 	// Return values
 	*maxiter = iteration;
@@ -381,7 +592,7 @@ void ScaleHMM::EM(int* maxiter, int* maxtime, double* eps)
 std::vector<double> ScaleHMM::calc_weights()
 {
 	std::vector<double> weights(this->N);
-	#pragma omp parallel for
+	#pragma omp parallel for num_threads(this->num_threads)
 	for (int iN=0; iN<this->N; iN++)
 	{
 		// Do not use weights[iN] = ( this->sumgamma[iN] + this->gamma[iN][T-1] ) / this->T; here, since states are swapped and gammas not
@@ -397,7 +608,7 @@ std::vector<double> ScaleHMM::calc_weights()
 
 void ScaleHMM::calc_weights(double* weights)
 {
-	#pragma omp parallel for
+	#pragma omp parallel for num_threads(this->num_threads)
 	for (int iN=0; iN<this->N; iN++)
 	{
 		// Do not use weights[iN] = ( this->sumgamma[iN] + this->gamma[iN][T-1] ) / this->T; here, since states are swapped and gammas not
@@ -410,6 +621,13 @@ void ScaleHMM::calc_weights(double* weights)
 	}
 }
 
+void ScaleHMM::summarize_posteriors(int* ind_max, double* value_max, double* margin, double* entropy, double* sum_per_state, const int* counts)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// Outputs are vectors [T] (and sum_per_state [N]) and may be NULL, see summarizePosteriors()
+	summarizePosteriors(this->gamma, this->N, this->T, counts, ind_max, value_max, margin, entropy, sum_per_state, this->num_threads);
+}
+
 // Getters and Setters ----------------------------------------
 void ScaleHMM::get_posteriors(double** post)
 {
@@ -423,6 +641,31 @@ void ScaleHMM::get_posteriors(double** post)
 	}
 }
 
+void ScaleHMM::get_densities(double** dens, bool fused)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// Densities of all states for the current parameters, either from calc_densities() or from the density function of every state
+	if (fused)
+	{
+		this->num_zero_densities.clear();
+		this->calc_densities();
+	}
+	for (int iN=0; iN<this->N; iN++)
+	{
+		if (fused)
+		{
+			for (int t=0; t<this->T; t++)
+			{
+				dens[iN][t] = this->densities[iN][t];
+			}
+		}
+		else
+		{
+			this->densityFunctions[iN]->calc_densities(dens[iN]);
+		}
+	}
+}
+
 double ScaleHMM::get_posterior(int iN, int t)
 {
 	//FILE_LOG(logDEBUG4) << __PRETTY_FUNCTION__;
@@ -444,410 +687,743 @@ double ScaleHMM::get_logP()
 	return( this->logP );
 }
 
+void ScaleHMM::get_cor_matrix(double* cor_matrix)
+{
+	for (unsigned int i=0; i<this->cor_matrix.size(); i++)
+	{
+		cor_matrix[i] = this->cor_matrix[i];
+	}
+}
+
 void ScaleHMM::set_cutoff(int cutoff)
 {
 	this->cutoff = cutoff;
 }
 
-// Private ====================================================
-// Methods ----------------------------------------------------
-void ScaleHMM::forward()
+void ScaleHMM::set_num_threads(int num_threads)
+{
+	this->num_threads = std::max(num_threads, 1);
+}
+
+void ScaleHMM::set_quiet(bool quiet)
+{
+	this->quiet = quiet;
+}
+
+void ScaleHMM::set_engine(whichengine engine)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
-//	clock_t time = clock(), dtime;
+	if (engine == this->engine) return;
+	this->engine = engine;
+	delete this->fb;
+	this->fb = new_forward_backward(engine, this->Tmax, this->N);
+	// The densities change between linear and log scale and have to be recomputed for all states
+	this->num_zero_densities.clear();
+}
 
-// 	if (not this->use_tdens)
-// 	{
+void ScaleHMM::set_observations(int* O, int T)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// Only a part of the allocated memory is used if T < Tmax
+	this->T = T;
+	this->obs = O;
+	this->max_obs = intMax(O, T);
+	this->encode_observations();
+	for (unsigned int iN=0; iN<this->densityFunctions.size(); iN++)
+	{
+		this->densityFunctions[iN]->set_observations(O, T);
+	}
+	this->num_zero_densities.clear();
+	this->segment_offsets.clear();
+	this->segment_logscale.clear();
+}
 
-		std::vector<double> alpha(this->N);
-		// Initialization
-		this->scalefactoralpha[0] = 0.0;
-		for (int iN=0; iN<this->N; iN++)
-		{
-			alpha[iN] = this->proba[iN] * this->densities[iN][0];
-			//FILE_LOG(logDEBUG4) << "alpha["<<iN<<"] = " << alpha[iN];
-			this->scalefactoralpha[0] += alpha[iN];
-		}
-		//FILE_LOG(logDEBUG4) << "scalefactoralpha["<<0<<"] = " << scalefactoralpha[0];
-		for (int iN=0; iN<this->N; iN++)
+void ScaleHMM::set_segments(int* O, int* segment_lengths, int num_segments)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// Each segment becomes one time point, its bins are stored as a histogram of the observed values
+	this->T = num_segments;
+	int Tbins = 0;
+	for (int s=0; s<num_segments; s++)
+	{
+		Tbins += segment_lengths[s];
+	}
+	this->segment_max_obs = intMax(O, Tbins);
+	std::vector<int> value_counts(this->segment_max_obs+1, 0);
+	this->segment_offsets.assign(1, 0);
+	this->segment_values.clear();
+	this->segment_counts.clear();
+	int t0 = 0;
+	for (int s=0; s<num_segments; s++)
+	{
+		for (int t=t0; t<t0+segment_lengths[s]; t++)
 		{
-			this->scalealpha[0][iN] = alpha[iN] / this->scalefactoralpha[0];
-			//FILE_LOG(logDEBUG4) << "scalealpha["<<0<<"]["<<iN<<"] = " << scalealpha[0][iN];
+			value_counts[O[t]]++;
 		}
-		// Induction
-		for (int t=1; t<this->T; t++)
+		for (int t=t0; t<t0+segment_lengths[s]; t++)
 		{
-			this->scalefactoralpha[t] = 0.0;
-			for (int iN=0; iN<this->N; iN++)
-			{
-				double helpsum = 0.0;
-				for (int jN=0; jN<this->N; jN++)
-				{
-					helpsum += this->scalealpha[t-1][jN] * this->A[jN][iN];
-				}
-				alpha[iN] = helpsum * this->densities[iN][t];
-				//FILE_LOG(logDEBUG4) << "alpha["<<iN<<"] = " << alpha[iN];
-				this->scalefactoralpha[t] += alpha[iN];
-			}
-			//FILE_LOG(logDEBUG4) << "scalefactoralpha["<<t<<"] = " << scalefactoralpha[t];
-			for (int iN=0; iN<this->N; iN++)
+			if (value_counts[O[t]] > 0)
 			{
-				this->scalealpha[t][iN] = alpha[iN] / this->scalefactoralpha[t];
-				//FILE_LOG(logDEBUG4) << "scalealpha["<<t<<"]["<<iN<<"] = " << scalealpha[t][iN];
-				if(std::isnan(this->scalealpha[t][iN]))
-				{
-					//FILE_LOG(logERROR) << __PRETTY_FUNCTION__;
-					for (int jN=0; jN<this->N; jN++)
-					{
-						//FILE_LOG(logERROR) << "scalealpha["<<t-1<<"]["<<jN<<"] = " << scalealpha[t-1][jN];
-						//FILE_LOG(logERROR) << "A["<<iN<<"]["<<jN<<"] = " << A[iN][jN];
-					}
-					//FILE_LOG(logERROR) << "scalefactoralpha["<<t<<"] = "<<scalefactoralpha[t] << ", densities = "<<densities[iN][t];
-					//FILE_LOG(logERROR) << "scalealpha["<<t<<"]["<<iN<<"] = " << scalealpha[t][iN];
-					throw nan_detected;
-				}
+				this->segment_values.push_back(O[t]);
+				this->segment_counts.push_back(value_counts[O[t]]);
+				value_counts[O[t]] = 0;
 			}
 		}
-
-// 	}
-// 	else if (this->use_tdens)
-// 	{
-// 
-// 		double alpha [this->N];
-// 		// Initialization
-// 		this->scalefactoralpha[0] = 0.0;
-// 		for (int iN=0; iN<this->N; iN++)
-// 		{
-// 			alpha[iN] = this->proba[iN] * this->tdensities[0][iN];
-// 			//FILE_LOG(logDEBUG4) << "alpha["<<iN<<"] = " << alpha[iN];
-// 			this->scalefactoralpha[0] += alpha[iN];
-// 		}
-// 		//FILE_LOG(logDEBUG4) << "scalefactoralpha["<<0<<"] = " << scalefactoralpha[0];
-// 		for (int iN=0; iN<this->N; iN++)
-// 		{
-// 			this->scalealpha[0][iN] = alpha[iN] / this->scalefactoralpha[0];
-// 			//FILE_LOG(logDEBUG4) << "scalealpha["<<0<<"]["<<iN<<"] = " << scalealpha[0][iN];
-// 		}
-// 		// Induction
-// 		for (int t=1; t<this->T; t++)
-// 		{
-// 			this->scalefactoralpha[t] = 0.0;
-// 			for (int iN=0; iN<this->N; iN++)
-// 			{
-// 				double helpsum = 0.0;
-// 				for (int jN=0; jN<this->N; jN++)
-// 				{
-// 					helpsum += this->scalealpha[t-1][jN] * this->A[jN][iN];
-// 				}
-// 				alpha[iN] = helpsum * this->tdensities[t][iN];
-// 				//FILE_LOG(logDEBUG4) << "alpha["<<iN<<"] = " << alpha[iN];
-// 				this->scalefactoralpha[t] += alpha[iN];
-// 			}
-// 			//FILE_LOG(logDEBUG4) << "scalefactoralpha["<<t<<"] = " << scalefactoralpha[t];
-// 			for (int iN=0; iN<this->N; iN++)
-// 			{
-// 				this->scalealpha[t][iN] = alpha[iN] / this->scalefactoralpha[t];
-// 				//FILE_LOG(logDEBUG4) << "scalealpha["<<t<<"]["<<iN<<"] = " << scalealpha[t][iN];
-// 				if(std::isnan(this->scalealpha[t][iN]))
-// 				{
-// 					//FILE_LOG(logWARNING) << __PRETTY_FUNCTION__;
-// 					for (int jN=0; jN<this->N; jN++)
-// 					{
-// 						//FILE_LOG(logWARNING) << "scalealpha["<<t-1<<"]["<<jN<<"] = " << scalealpha[t-1][jN];
-// 						//FILE_LOG(logWARNING) << "A["<<iN<<"]["<<jN<<"] = " << A[iN][jN];
-// 					}
-// 					//FILE_LOG(logWARNING) << "scalefactoralpha["<<t<<"] = "<<scalefactoralpha[t] << ", tdensities = "<<tdensities[t][iN];
-// 					//FILE_LOG(logWARNING) << "scalealpha["<<t<<"]["<<iN<<"] = " << scalealpha[t][iN];
-// 					exit(1);
-// 				}
-// 			}
-// 		}
-// 
-// 	}
-
-//	dtime = clock() - time;
-//	//FILE_LOG(logDEBUG) << "forward(): " << dtime << " clicks";
+		this->segment_offsets.push_back(this->segment_values.size());
+		t0 += segment_lengths[s];
+	}
+	this->segment_logscale.assign(num_segments, 0.0);
+	this->num_zero_densities.clear();
 }
 
-void ScaleHMM::backward()
+void ScaleHMM::set_copula(int** multi_O, int* comb_states, double* cor_matrix)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
-//	clock_t time = clock(), dtime;
-
-// 	if (not this->use_tdens)
-// 	{
+	// The densities are computed from a Gaussian copula of the marginals, which must be set before
+	// multi_O holds the observations [T] of each modification, comb_states is a matrix [Nmod x N] of the (0-based) univariate state of each modification in each combined state and cor_matrix an array [Nmod x Nmod x N]
+	int M = this->Nmod;
+	this->multi_obs.assign(multi_O, multi_O + M);
+	this->comb_states.assign(comb_states, comb_states + M * this->N);
+	this->cor_matrix.assign(cor_matrix, cor_matrix + M * M * this->N);
+	this->cor_matrix_inv.resize(M * M * this->N);
+	this->cor_matrix_determinant.resize(this->N);
+	this->invert_cor_matrices();
+	this->tabulate_marginals();
+	this->update_copula_densityFunctions();
+}
 
-		std::vector<double> beta(this->N);
-		// Initialization
-		for (int iN=0; iN<this->N; iN++)
-		{
-			beta[iN] = 1.0;
-			//FILE_LOG(logDEBUG4) << "beta["<<iN<<"] = " << beta[iN];
-		}
-		//FILE_LOG(logDEBUG4) << "scalefactoralpha["<<T-1<<"] = " << scalefactoralpha[T-1];
-		for (int iN=0; iN<this->N; iN++)
+void ScaleHMM::encode_observations()
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// Observations are stored as 1 or 2 byte indices into the distinct values, which cuts the memory traffic of the loops over all bins
+	// Encoding is only done if the tables of densities per observed value are used (max(O)<=T)
+	this->obs_values.clear();
+	this->obs_codes8.clear();
+	this->obs_codes16.clear();
+	if (this->max_obs > this->T) return;
+	std::vector<int> code_of_value(this->max_obs+1, -1);
+	// Mark the values that occur, then number them in ascending order
+	for (int t=0; t<this->T; t++)
+	{
+		code_of_value[this->obs[t]] = 0;
+	}
+	for (int j=0; j<=this->max_obs; j++)
+	{
+		if (code_of_value[j] >= 0)
 		{
-			this->scalebeta[T-1][iN] = beta[iN] / this->scalefactoralpha[T-1];
-			//FILE_LOG(logDEBUG4) << "scalebeta["<<T-1<<"]["<<iN<<"] = " << scalebeta[T-1][iN];
+			code_of_value[j] = this->obs_values.size();
+			this->obs_values.push_back(j);
 		}
-		// Induction
-		for (int t=this->T-2; t>=0; t--)
+	}
+	if (this->obs_values.size() <= 256)
+	{
+		this->obs_codes8.resize(this->T);
+		for (int t=0; t<this->T; t++)
 		{
-			for (int iN=0; iN<this->N; iN++)
-			{
-				beta[iN] = 0.0;
-				for(int jN=0; jN<this->N; jN++)
-				{
-					beta[iN] += this->A[iN][jN] * this->densities[jN][t+1] * this->scalebeta[t+1][jN];
-				}
-				//FILE_LOG(logDEBUG4) << "beta["<<iN<<"] = " << beta[iN];
-			}
-			//FILE_LOG(logDEBUG4) << "scalefactoralpha["<<t<<"] = " << scalefactoralpha[t];
-			for (int iN=0; iN<this->N; iN++)
-			{
-				this->scalebeta[t][iN] = beta[iN] / this->scalefactoralpha[t];
-				//FILE_LOG(logDEBUG4) << "scalebeta["<<t<<"]["<<iN<<"] = " << scalebeta[t][iN];
-				if (std::isnan(this->scalebeta[t][iN]))
-				{
-					//FILE_LOG(logERROR) << __PRETTY_FUNCTION__;
-					for (int jN=0; jN<this->N; jN++)
-					{
-						//FILE_LOG(logERROR) << "scalebeta["<<jN<<"]["<<t+1<<"] = " << scalebeta[t+1][jN];
-						//FILE_LOG(logERROR) << "A["<<iN<<"]["<<jN<<"] = " << A[iN][jN];
-						//FILE_LOG(logERROR) << "densities["<<jN<<"]["<<t+1<<"] = " << densities[jN][t+1];
-					}
-					//FILE_LOG(logERROR) << "this->scalefactoralpha[t]["<<t<<"] = "<<this->scalefactoralpha[t] << ", densities = "<<densities[iN][t];
-					//FILE_LOG(logERROR) << "scalebeta["<<iN<<"]["<<t<<"] = " << scalebeta[t][iN];
-					throw nan_detected;
-				}
-			}
+			this->obs_codes8[t] = code_of_value[this->obs[t]];
+		}
+	}
+	else if (this->obs_values.size() <= 65536)
+	{
+		this->obs_codes16.resize(this->T);
+		for (int t=0; t<this->T; t++)
+		{
+			this->obs_codes16[t] = code_of_value[this->obs[t]];
 		}
+	}
+	else
+	{
+		this->obs_values.clear();
+	}
+}
 
-// 	}
-// 	else if (this->use_tdens)
-// 	{
-// 
-// 		double beta [this->N];
-// 		// Initialization
-// 		for (int iN=0; iN<this->N; iN++)
-// 		{
-// 			beta[iN] = 1.0;
-// 			//FILE_LOG(logDEBUG4) << "beta["<<iN<<"] = " << beta[iN];
-// 		}
-// 		//FILE_LOG(logDEBUG4) << "scalefactoralpha["<<T-1<<"] = " << scalefactoralpha[T-1];
-// 		for (int iN=0; iN<this->N; iN++)
-// 		{
-// 			this->scalebeta[T-1][iN] = beta[iN] / this->scalefactoralpha[T-1];
-// 			//FILE_LOG(logDEBUG4) << "scalebeta["<<T-1<<"]["<<iN<<"] = " << scalebeta[T-1][iN];
-// 		}
-// 		// Induction
-// 		for (int t=this->T-2; t>=0; t--)
-// 		{
-// 			for (int iN=0; iN<this->N; iN++)
-// 			{
-// 				//FILE_LOG(logDEBUG4) << "Calculating backward variable for state " << iN;
-// 				beta[iN] = 0.0;
-// 				for(int jN=0; jN<this->N; jN++)
-// 				{
-// 					beta[iN] += this->A[iN][jN] * this->tdensities[t+1][jN] * this->scalebeta[t+1][jN];
-// 				}
-// 			}
-// 			//FILE_LOG(logDEBUG4) << "scalefactoralpha["<<t<<"] = " << scalefactoralpha[t];
-// 			for (int iN=0; iN<this->N; iN++)
-// 			{
-// 				this->scalebeta[t][iN] = beta[iN] / this->scalefactoralpha[t];
-// 				//FILE_LOG(logDEBUG4) << "scalebeta["<<t<<"]["<<iN<<"] = " << scalebeta[t][iN];
-// 				if (std::isnan(this->scalebeta[t][iN]))
-// 				{
-// 					//FILE_LOG(logWARNING) << __PRETTY_FUNCTION__;
-// 					for (int jN=0; jN<this->N; jN++)
-// 					{
-// 						//FILE_LOG(logWARNING) << "scalebeta["<<jN<<"]["<<t+1<<"] = " << scalebeta[t+1][jN];
-// 						//FILE_LOG(logWARNING) << "A["<<iN<<"]["<<jN<<"] = " << A[iN][jN];
-// 						//FILE_LOG(logWARNING) << "tdensities["<<t+1<<"]["<<jN<<"] = " << tdensities[t+1][jN];
-// 					}
-// 					//FILE_LOG(logWARNING) << "this->scalefactoralpha[t]["<<t<<"] = "<<this->scalefactoralpha[t] << ", tdensities = "<<densities[t][iN];
-// 					//FILE_LOG(logWARNING) << "scalebeta["<<iN<<"]["<<t<<"] = " << scalebeta[t][iN];
-// 					exit(1);
-// 				}
-// 			}
-// 		}
-// 
-// 	}
+void ScaleHMM::set_checkpoint(const char* checkpoint_file, int checkpoint_interval, unsigned int fingerprint)
+{
+	this->checkpoint_file = checkpoint_file;
+	this->checkpoint_interval = checkpoint_interval;
+	this->checkpoint_fingerprint = fingerprint;
+}
 
-//	dtime = clock() - time;
-//	//FILE_LOG(logDEBUG) << "backward(): " << dtime << " clicks";
+// Private ====================================================
+// Methods ----------------------------------------------------
+void ScaleHMM::forward()
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	this->fb->forward(this->A, this->proba, this->densities, this->T);
+}
+
+void ScaleHMM::backward()
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	this->fb->backward(this->A, this->densities, this->T);
 }
 
 void ScaleHMM::calc_sumgamma()
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
-//	clock_t time = clock(), dtime;
+	this->fb->calc_sumgamma(this->gamma, this->sumgamma, this->T, this->num_threads);
+}
 
-	// Initialize the sumgamma
-	for (int iN=0; iN<this->N; iN++)
+void ScaleHMM::calc_sumxi()
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	this->fb->calc_sumxi(this->A, this->densities, this->sumxi, this->T, this->num_threads);
+}
+
+void ScaleHMM::calc_loglikelihood()
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	this->logP = this->fb->loglikelihood(this->T);
+	// Add the log-densities that were factored out of the segment densities
+	for (unsigned int t=0; t<this->segment_logscale.size(); t++)
 	{
-		this->sumgamma[iN] = 0.0;
+		this->logP += this->segment_logscale[t];
 	}
+}
 
-	// Compute the gammas (posteriors) and sumgamma
-	#pragma omp parallel for
-	for (int iN=0; iN<this->N; iN++)
+// Densities per observed value for the distributions that have them, dispatched on the name instead of a virtual call
+static bool calc_densities_per_read(Density* d, double* dens_per_read, int max_obs)
+{
+	switch (d->get_name())
 	{
-		for (int t=0; t<this->T; t++)
-		{
-			this->gamma[iN][t] = this->scalealpha[t][iN] * this->scalebeta[t][iN] * this->scalefactoralpha[t];
-			this->sumgamma[iN] += this->gamma[iN][t];
-		}
+		case NEGATIVE_BINOMIAL:
+			((NegativeBinomial*) d)->calc_densities_per_read(dens_per_read, max_obs);
+			return true;
+		case GEOMETRIC:
+			((Geometric*) d)->calc_densities_per_read(dens_per_read, max_obs);
+			return true;
+		case ZERO_INFLATION:
+			((ZeroInflation*) d)->calc_densities_per_read(dens_per_read, max_obs);
+			return true;
+		case POISSON:
+			((Poisson*) d)->calc_densities_per_read(dens_per_read, max_obs);
+			return true;
+		case BINOMIAL:
+			((Binomial*) d)->calc_densities_per_read(dens_per_read, max_obs);
+			return true;
+		case ZERO_INFLATED_NEGATIVE_BINOMIAL:
+			((ZeroInflatedNegativeBinomial*) d)->calc_densities_per_read(dens_per_read, max_obs);
+			return true;
+		default:
+			return false;
 	}
-	// Subtract the last value because sumgamma goes only until T-1 and we computed until T to get also loggamma at T
-	for (int iN=0; iN<this->N; iN++)
+}
+
+// Write densities[iN][t] = tables[i][codes[t]] for the states iN = states[i] and update the number of zero densities, returns true if a nan was encountered
+template<typename code_t>
+static bool gather_densities(const code_t* codes, int T, const std::vector<int>& states, const std::vector< std::vector<double> >& tables, double** densities, std::vector<int>& num_zero_densities, int num_threads)
+{
+	// Blocks of time points are independent, every thread writes the densities and zero counts of its own blocks
+	const int block = 4096;
+	int num_blocks = (T + block - 1) / block;
+	std::vector<char> nan_encountered(num_blocks, 0);
+	int num_states = states.size();
+	#pragma omp parallel for num_threads(num_threads)
+	for (int b=0; b<num_blocks; b++)
 	{
-		this->sumgamma[iN] -= this->gamma[iN][T-1];
+		int tend = std::min(T, (b+1) * block);
+		for (int t=b*block; t<tend; t++)
+		{
+			int j = codes[t];
+			for (int i=0; i<num_states; i++)
+			{
+				int iN = states[i];
+				double dens = tables[i][j];
+				if (std::isnan(dens)) nan_encountered[b] = 1;
+				if (densities[iN][t] == 0.0) num_zero_densities[t]--;
+				if (dens == 0.0) num_zero_densities[t]++;
+				densities[iN][t] = dens;
+			}
+		}
 	}
-
-//	dtime = clock() - time;
-//	//FILE_LOG(logDEBUG) << "calc_sumgamma(): " << dtime << " clicks";
+	return std::find(nan_encountered.begin(), nan_encountered.end(), 1) != nan_encountered.end();
 }
 
-void ScaleHMM::calc_sumxi()
+void ScaleHMM::calc_densities()
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
 //	clock_t time = clock(), dtime;
+	if (this->segment_offsets.size() > 0)
+	{
+		this->calc_segment_densities();
+		return;
+	}
+	this->fb->set_logdensities(NULL);
+	if (this->engine == LOG_SPACE)
+	{
+		this->calc_logdensities(this->densities);
+		return;
+	}
 
-	double xi;
-	// Initialize the sumxi
-	for (int iN=0; iN<this->N; iN++)
+	if (this->num_zero_densities.size() == 0)
 	{
-		for (int jN=0; jN<this->N; jN++)
+		this->densities_version.assign(this->N, -1);
+		this->num_zero_densities.assign(this->T, 0);
+		for (int iN=0; iN<this->N; iN++)
 		{
-			this->sumxi[iN][jN] = 0.0;
+			for (int t=0; t<this->T; t++)
+			{
+				if (this->densities[iN][t] == 0.0) this->num_zero_densities[t]++;
+			}
 		}
-	}	
-
-	// Compute the sumxi
-// 	if (not this->use_tdens)
-// 	{
+	}
 
-		#pragma omp parallel for
-		for (int iN=0; iN<this->N; iN++)
+	// Only states whose parameters changed since the last call need to be recomputed
+	// States with a table of densities per observed value are written together in one pass over the observations
+	std::vector<int> changed_states, table_states;
+	std::vector< std::vector<double> > tables;
+	std::vector<NegativeBinomial*> nb_members;
+	std::vector<int> nb_tables;
+	for (int iN=0; iN<this->N; iN++)
+	{
+		if (this->densityFunctions[iN]->get_version() != this->densities_version[iN])
 		{
-			//FILE_LOG(logDEBUG3) << "Calculating sumxi["<<iN<<"][jN]";
-			for (int t=0; t<this->T-1; t++)
+			if ((this->obs != NULL) && (this->max_obs <= this->T))
 			{
-				for (int jN=0; jN<this->N; jN++)
+				if (this->densityFunctions[iN]->get_name() == NEGATIVE_BINOMIAL)
+				{
+					// Computed below together with the other negative binomials
+					table_states.push_back(iN);
+					tables.push_back(std::vector<double>(this->max_obs+1));
+					nb_members.push_back((NegativeBinomial*) this->densityFunctions[iN]);
+					nb_tables.push_back(tables.size()-1);
+					continue;
+				}
+				std::vector<double> dens_per_read(this->max_obs+1);
+				if (calc_densities_per_read(this->densityFunctions[iN], &dens_per_read[0], this->max_obs))
+				{
+					table_states.push_back(iN);
+					tables.push_back(dens_per_read);
+					continue;
+				}
+			}
+			changed_states.push_back(iN);
+			for (int t=0; t<this->T; t++)
+			{
+				if (this->densities[iN][t] == 0.0) this->num_zero_densities[t]--;
+			}
+		}
+	}
+	int num_nb = nb_members.size();
+	if (num_nb > 0)
+	{
+		// The tied states of the copy numbers share the work of computing their tables
+		std::vector<double*> nb_dens_per_read(num_nb);
+		for (int i=0; i<num_nb; i++)
+		{
+			nb_dens_per_read[i] = &tables[nb_tables[i]][0];
+		}
+		NegativeBinomial::calc_densities_per_read(&nb_members[0], num_nb, &nb_dens_per_read[0], this->max_obs);
+	}
+	int num_table = table_states.size();
+	if (num_table > 0)
+	{
+		bool nan_encountered;
+		if (this->obs_values.size() > 0)
+		{
+			// Tables per distinct value are small enough to stay in the cache, compacted in place because obs_values[c] >= c
+			int num_values = this->obs_values.size();
+			for (int i=0; i<num_table; i++)
+			{
+				for (int c=0; c<num_values; c++)
 				{
-					xi = this->scalealpha[t][iN] * this->A[iN][jN] * this->densities[jN][t+1] * this->scalebeta[t+1][jN];
-					this->sumxi[iN][jN] += xi;
+					tables[i][c] = tables[i][this->obs_values[c]];
 				}
 			}
+			if (this->obs_codes8.size() > 0)
+			{
+				nan_encountered = gather_densities(&this->obs_codes8[0], this->T, table_states, tables, this->densities, this->num_zero_densities, this->num_threads);
+			}
+			else
+			{
+				nan_encountered = gather_densities(&this->obs_codes16[0], this->T, table_states, tables, this->densities, this->num_zero_densities, this->num_threads);
+			}
+		}
+		else
+		{
+			nan_encountered = gather_densities(this->obs, this->T, table_states, tables, this->densities, this->num_zero_densities, this->num_threads);
+		}
+		if (nan_encountered)
+		{
+			//FILE_LOG(logERROR) << "nan in emission densities";
+			this->num_zero_densities.clear();
+			throw nan_detected;
+		}
+		for (int i=0; i<num_table; i++)
+		{
+			this->densities_version[table_states[i]] = this->densityFunctions[table_states[i]]->get_version();
 		}
+	}
+	int num_changed = changed_states.size();
+
+	// Errors thrown inside a #pragma must be handled inside the thread, they are rethrown afterwards. The flags are chars, because threads must not write to
+	// neighbouring bits of a std::vector<bool>.
+	std::vector<char> nan_encountered(this->N, 0);
+	std::vector<std::exception_ptr> error_encountered(this->N);
+	#pragma omp parallel for num_threads(this->num_threads)
+	for (int i=0; i<num_changed; i++)
+	{
+		int iN = changed_states[i];
+		//FILE_LOG(logDEBUG3) << "Calculating densities for state " << iN;
+		try
+		{
+			this->densityFunctions[iN]->calc_densities(this->densities[iN]);
+		}
+		catch(std::exception& e)
+		{
+			if (strcmp(e.what(),"nan detected")==0) { nan_encountered[iN]=1; }
+			else { error_encountered[iN] = std::current_exception(); }
+		}
+		catch(...)
+		{
+			error_encountered[iN] = std::current_exception();
+		}
+	}
+	for (int iN=0; iN<this->N; iN++)
+	{
+		if (nan_encountered[iN] || error_encountered[iN])
+		{
+			// Invalidate the cache, densities of the other changed states may be incomplete
+			this->num_zero_densities.clear();
+			if (error_encountered[iN]) std::rethrow_exception(error_encountered[iN]);
+			throw nan_detected;
+		}
+	}
+	for (int i=0; i<num_changed; i++)
+	{
+		int iN = changed_states[i];
+		this->densities_version[iN] = this->densityFunctions[iN]->get_version();
+		for (int t=0; t<this->T; t++)
+		{
+			if (this->densities[iN][t] == 0.0) this->num_zero_densities[t]++;
+		}
+	}
 
-// 	}
-// 	else if (this->use_tdens)
-// 	{
-// 
-// 		#pragma omp parallel for
-// 		for (int iN=0; iN<this->N; iN++)
-// 		{
-// 			//FILE_LOG(logDEBUG3) << "Calculating sumxi["<<iN<<"][jN]";
-// 			for (int t=0; t<this->T-1; t++)
-// 			{
-// 				for (int jN=0; jN<this->N; jN++)
-// 				{
-// 					xi = this->scalealpha[t][iN] * this->A[iN][jN] * this->tdensities[t+1][jN] * this->scalebeta[t+1][jN];
-// 					this->sumxi[iN][jN] += xi;
-// 				}
-// 			}
-// 		}
-// 
-// 	}
+	// Where the densities of all states are numerically zero, the recursions switch to log blocks and need the log-densities
+	for (int t=0; t<this->T; t++)
+	{
+		if (this->num_zero_densities[t] == this->N)
+		{
+			//FILE_LOG(logDEBUG1) << "densities of all states are zero at t = " << t << ", calculating log-densities";
+			if (this->logdensities == NULL) this->logdensities = newDoubleMatrix(this->N, this->Tmax);
+			this->calc_logdensities(this->logdensities);
+			this->fb->set_logdensities(this->logdensities);
+			break;
+		}
+	}
 
 //	dtime = clock() - time;
-//	//FILE_LOG(logDEBUG) << "calc_sumxi(): " << dtime << " clicks";
+//	//FILE_LOG(logDEBUG) << "calc_densities(): " << dtime << " clicks";
 }
 
-void ScaleHMM::calc_loglikelihood()
+void ScaleHMM::calc_logdensities(double** logdensities)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
-//	clock_t time = clock(), dtime;
+	// Errors thrown inside a #pragma must be handled inside the thread, they are rethrown afterwards
+	std::vector<char> nan_encountered(this->N, 0);
+	std::vector<std::exception_ptr> error_encountered(this->N);
+	#pragma omp parallel for num_threads(this->num_threads)
+	for (int iN=0; iN<this->N; iN++)
+	{
+		//FILE_LOG(logDEBUG3) << "Calculating log-densities for state " << iN;
+		try
+		{
+			this->densityFunctions[iN]->calc_logdensities(logdensities[iN]);
+		}
+		catch(std::exception& e)
+		{
+			if (strcmp(e.what(),"nan detected")==0) { nan_encountered[iN]=1; }
+			else { error_encountered[iN] = std::current_exception(); }
+		}
+		catch(...)
+		{
+			error_encountered[iN] = std::current_exception();
+		}
+	}
+	for (int iN=0; iN<this->N; iN++)
+	{
+		if (error_encountered[iN]) std::rethrow_exception(error_encountered[iN]);
+		if (nan_encountered[iN]) throw nan_detected;
+	}
 
-	this->logP = 0.0;
+	// Observations that no state can explain are made uninformative
 	for (int t=0; t<this->T; t++)
 	{
-		this->logP += log(this->scalefactoralpha[t]);
+		bool all_zero = true;
+		for (int iN=0; iN<this->N; iN++)
+		{
+			if (logdensities[iN][t] > -INFINITY) { all_zero = false; break; }
+		}
+		if (all_zero)
+		{
+			for (int iN=0; iN<this->N; iN++)
+			{
+				logdensities[iN][t] = 0.0;
+			}
+		}
 	}
+}
 
-//	dtime = clock() - time;
-//	//FILE_LOG(logDEBUG) << "calc_loglikelihood(): " << dtime << " clicks";
+// Add weights[t] to histogram[codes[t]]
+template<typename code_t>
+static void sum_by_code(const code_t* codes, int T, const double* weights, double* histogram)
+{
+	for (int t=0; t<T; t++)
+	{
+		histogram[codes[t]] += weights[t];
+	}
 }
 
-void ScaleHMM::calc_densities()
+void ScaleHMM::calc_histograms(double** histogram)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
-//	clock_t time = clock(), dtime;
-	// Errors thrown inside a #pragma must be handled inside the thread
-	std::vector<bool> nan_encountered(this->N);
-	#pragma omp parallel for
+	// Sum the posteriors per observed value into the zero-initialized matrix histogram[N x max_obs+1]
+	int num_values = this->obs_values.size();
+	std::vector<double> code_histogram(num_values);
 	for (int iN=0; iN<this->N; iN++)
 	{
-		//FILE_LOG(logDEBUG3) << "Calculating densities for state " << iN;
-		try
+		if (this->obs_codes8.size() > 0)
 		{
-			this->densityFunctions[iN]->calc_densities(this->densities[iN]);
+			code_histogram.assign(num_values, 0.0);
+			sum_by_code(&this->obs_codes8[0], this->T, this->gamma[iN], &code_histogram[0]);
 		}
-		catch(std::exception& e)
+		else if (this->obs_codes16.size() > 0)
+		{
+			code_histogram.assign(num_values, 0.0);
+			sum_by_code(&this->obs_codes16[0], this->T, this->gamma[iN], &code_histogram[0]);
+		}
+		else
 		{
-			if (strcmp(e.what(),"nan detected")==0) { nan_encountered[iN]=true; }
-			else { throw; }
+			sum_by_code(this->obs, this->T, this->gamma[iN], histogram[iN]);
+			continue;
+		}
+		for (int c=0; c<num_values; c++)
+		{
+			histogram[iN][this->obs_values[c]] = code_histogram[c];
 		}
 	}
+}
+
+void ScaleHMM::update_densities_from_histogram(double** histogram, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	this->update_densities_from_histogram(this->densityFunctions, histogram, max_obs);
+}
+
+void ScaleHMM::update_densities_from_histogram(std::vector<Density*>& densityFunctions, double** histogram, int max_obs)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// Same as the update in EM(), but with posteriors aggregated per observed value in histogram[iN][j]
+	update_tied_densities_from_histogram(densityFunctions, histogram, max_obs);
+}
+
+void ScaleHMM::calc_segment_densities()
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// The density of a segment is the product of the densities of its bins, computed from the histogram of the segment
+	std::vector<double> logdens_per_read(this->segment_max_obs+1);
 	for (int iN=0; iN<this->N; iN++)
 	{
-		if (nan_encountered[iN]==true)
+		this->densityFunctions[iN]->calc_logdensities_per_read(&logdens_per_read[0], this->segment_max_obs);
+		for (int t=0; t<this->T; t++)
 		{
-			throw nan_detected;
+			double logdens = 0.0;
+			for (int k=this->segment_offsets[t]; k<this->segment_offsets[t+1]; k++)
+			{
+				logdens += this->segment_counts[k] * logdens_per_read[this->segment_values[k]];
+			}
+			this->densities[iN][t] = logdens;
 		}
 	}
 
-	// Check if the density for all states is numerically zero and correct to prevent NaNs
-	std::vector<double> temp(this->N);
-	// t=0
+	// Factor out the largest log-density of each segment, products over many bins are far below the range of double
+	for (int t=0; t<this->T; t++)
+	{
+		double logdens_max = -INFINITY;
+		for (int iN=0; iN<this->N; iN++)
+		{
+			if (this->densities[iN][t] > logdens_max) logdens_max = this->densities[iN][t];
+		}
+		if (logdens_max == -INFINITY)
+		{
+			// No state can explain the segment, make it uninformative
+			this->segment_logscale[t] = 0.0;
+			for (int iN=0; iN<this->N; iN++)
+			{
+				this->densities[iN][t] = 1.0;
+			}
+			continue;
+		}
+		this->segment_logscale[t] = logdens_max;
+		for (int iN=0; iN<this->N; iN++)
+		{
+			this->densities[iN][t] = exp(this->densities[iN][t] - logdens_max);
+			if (std::isnan(this->densities[iN][t]))
+			{
+				//FILE_LOG(logERROR) << "densities["<<iN<<"]["<<t<<"] = " << this->densities[iN][t];
+				throw nan_detected;
+			}
+		}
+	}
+}
+
+void ScaleHMM::update_densities_from_segments()
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// The posterior of a segment applies to all of its bins
+	double** histogram = newDoubleMatrix(this->N, this->segment_max_obs+1);
 	for (int iN=0; iN<this->N; iN++)
 	{
-		temp[iN] = this->densities[iN][0];
+		for (int t=0; t<this->T; t++)
+		{
+			for (int k=this->segment_offsets[t]; k<this->segment_offsets[t+1]; k++)
+			{
+				histogram[iN][this->segment_values[k]] += this->gamma[iN][t] * this->segment_counts[k];
+			}
+		}
 	}
-	if (*std::max_element(temp.begin(), temp.end()) == 0.0)
+	this->update_densities_from_histogram(histogram, this->segment_max_obs);
+	deleteDoubleMatrix(histogram, this->N);
+}
+
+void ScaleHMM::calc_copula_densities()
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// Every task computes one state over one block of bins
+	const int block = 4096;
+	int num_blocks = (this->T + block - 1) / block;
+	#pragma omp parallel for schedule(dynamic) num_threads(this->num_threads)
+	for (int task=0; task<this->N * num_blocks; task++)
+	{
+		int iN = task / num_blocks;
+		int tstart = (task % num_blocks) * block;
+		int tend = std::min(tstart + block, this->T);
+		((MVCopulaApproximation*) this->densityFunctions[iN])->calc_densities(this->densities[iN], tstart, tend);
+	}
+	// Bins where the densities of all states are zero get the densities of the previous bin, or 1e-10 in the first bin
+	for (int t=0; t<this->T; t++)
 	{
+		double sum = 0.0;
 		for (int iN=0; iN<this->N; iN++)
 		{
-			this->densities[iN][0] = 0.00000000001;
+			sum += this->densities[iN][t];
+		}
+		if (sum == 0)
+		{
+			for (int iN=0; iN<this->N; iN++)
+			{
+				this->densities[iN][t] = (t == 0) ? 1e-10 : this->densities[iN][t-1];
+			}
 		}
 	}
-	// t>0
-	for (int t=1; t<this->T; t++)
+}
+
+void ScaleHMM::update_copula()
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	int M = this->Nmod;
+	int num_states = this->marginals[0].size();
+	// The posterior of a univariate state of one modification is the sum over the combined states that contain it
+	// With these posteriors the marginals are updated as in the univariate HMM
+	for (int imod=0; imod<M; imod++)
 	{
+		int max_obs = intMax(this->multi_obs[imod], this->T);
+		double** histogram = newDoubleMatrix(num_states, max_obs+1);
 		for (int iN=0; iN<this->N; iN++)
 		{
-			temp[iN] = this->densities[iN][t];
+			sum_by_code(this->multi_obs[imod], this->T, this->gamma[iN], histogram[this->comb_states[iN * M + imod]]);
 		}
-		if (*std::max_element(temp.begin(), temp.end()) == 0.0)
+		this->update_densities_from_histogram(this->marginals[imod], histogram, max_obs);
+		deleteDoubleMatrix(histogram, num_states);
+	}
+	this->tabulate_marginals();
+	// Correlations of the z-values in each combined state, with the posteriors as weights (Welford, see copula_correlations())
+	#pragma omp parallel for num_threads(this->num_threads)
+	for (int iN=0; iN<this->N; iN++)
+	{
+		std::vector<const double*> z_table(M);
+		for (int i=0; i<M; i++)
 		{
-			for (int iN=0; iN<this->N; iN++)
+			z_table[i] = &this->marginal_z_per_read[i][this->comb_states[iN * M + i]][0];
+		}
+		double sumw = 0.0;
+		std::vector<double> mean(M, 0.0), comoment(M * M, 0.0), z(M);
+		for (int t=0; t<this->T; t++)
+		{
+			for (int i=0; i<M; i++)
 			{
-				this->densities[iN][t] = this->densities[iN][t-1];
+				z[i] = z_table[i][this->multi_obs[i][t]];
 			}
+			updateComoments(&z[0], this->gamma[iN][t], M, &sumw, &mean[0], &comoment[0]);
 		}
+		// States with a summed posterior below 2 keep their correlations
+		if (sumw < 2) continue;
+		correlationInverse(&comoment[0], M, &this->cor_matrix[iN * M * M], &this->cor_matrix_inv[iN * M * M], &this->cor_matrix_determinant[iN]);
 	}
+	this->update_copula_densityFunctions();
+}
 
-//	dtime = clock() - time;
-//	//FILE_LOG(logDEBUG) << "calc_densities(): " << dtime << " clicks";
+void ScaleHMM::invert_cor_matrices()
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	int M = this->Nmod;
+	for (int iN=0; iN<this->N; iN++)
+	{
+		invertCorrelation(&this->cor_matrix[iN * M * M], M, &this->cor_matrix_inv[iN * M * M], &this->cor_matrix_determinant[iN]);
+	}
+}
+
+void ScaleHMM::tabulate_marginals()
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// Densities and z-values of each marginal are tabulated once and shared by all combined states that contain it
+	int M = this->Nmod;
+	int num_states = this->marginals[0].size();
+	this->marginal_dens_per_read.resize(M, std::vector<std::vector<double> >(num_states));
+	this->marginal_z_per_read.resize(M, std::vector<std::vector<double> >(num_states));
+	for (int imod=0; imod<M; imod++)
+	{
+		int max_obs = intMax(this->multi_obs[imod], this->T);
+		for (int i=0; i<num_states; i++)
+		{
+			MVCopulaApproximation::tabulate_marginal(this->marginals[imod][i], max_obs, this->marginal_dens_per_read[imod][i], this->marginal_z_per_read[imod][i]);
+		}
+	}
+}
+
+void ScaleHMM::update_copula_densityFunctions()
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	// The copulas only point to the tables of the marginals, so recreating them with the new correlations is cheap
+	int M = this->Nmod;
+	for (unsigned int iN=0; iN<this->densityFunctions.size(); iN++)
+	{
+		delete this->densityFunctions[iN];
+	}
+	this->densityFunctions.resize(this->N);
+	for (int iN=0; iN<this->N; iN++)
+	{
+		std::vector<const double*> dens_tables(M), z_tables(M);
+		for (int imod=0; imod<M; imod++)
+		{
+			dens_tables[imod] = &this->marginal_dens_per_read[imod][this->comb_states[iN * M + imod]][0];
+			z_tables[imod] = &this->marginal_z_per_read[imod][this->comb_states[iN * M + imod]][0];
+		}
+		this->densityFunctions[iN] = new MVCopulaApproximation(&this->multi_obs[0], this->T, dens_tables, z_tables, &this->cor_matrix_inv[iN * M * M], this->cor_matrix_determinant[iN]);
+	}
+}
+
+void ScaleHMM::check_user_interrupt()
+{
+	// R must not be called from other threads than the main thread
+	if (!this->quiet) R_CheckUserInterrupt();
 }
 
 void ScaleHMM::print_uni_iteration(int iteration)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
 	this->EMTime_real = difftime(time(NULL),this->EMStartTime_sec);
+	if (this->quiet) return;
 	int bs = 106;
 	char buffer [106];
 	if (iteration % 20 == 0)
@@ -879,6 +1455,7 @@ void ScaleHMM::print_multi_iteration(int iteration)
 {
 	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
 	this->EMTime_real = difftime(time(NULL),this->EMStartTime_sec);
+	if (this->quiet) return;
 	int bs = 86;
 	char buffer [86];
 	if (iteration % 20 == 0)
@@ -987,4 +1564,163 @@ void ScaleHMM::print_uni_params()
 	R_FlushConsole();
 }
 
+// Checkpoints ------------------------------------------------
+// Binary layout (native byte order): magic, version, xvariate, T, N, fingerprint, iteration, logP, dlogP, A[N x N], proba[N],
+// number of densities followed by (name, mean, variance) for each (and w for zero-inflated negative binomials), length of logP history followed by the history itself.
+static const char checkpoint_magic[8] = "AFHMMCP";
+static const int checkpoint_version = 2;
 
+void ScaleHMM::write_checkpoint(int iteration, double logPlast, int nhistory)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	if (this->checkpoint_file.empty()) return;
+
+	// Write to a temporary file first, so that an interrupted write never destroys the previous checkpoint
+	std::string tmpfile = this->checkpoint_file + ".tmp";
+	FILE* pFile = fopen(tmpfile.c_str(), "wb");
+	if (pFile == NULL)
+	{
+		//FILE_LOG(logWARNING) << "Could not open checkpoint file " << tmpfile;
+		Rprintf("Could not open checkpoint file %s\n", tmpfile.c_str());
+		return;
+	}
+	int xvariate = this->xvariate;
+	int numdensities = this->densityFunctions.size();
+	bool ok = true;
+	ok = ok && fwrite(checkpoint_magic, sizeof(char), 8, pFile) == 8;
+	ok = ok && fwrite(&checkpoint_version, sizeof(int), 1, pFile) == 1;
+	ok = ok && fwrite(&xvariate, sizeof(int), 1, pFile) == 1;
+	ok = ok && fwrite(&this->T, sizeof(int), 1, pFile) == 1;
+	ok = ok && fwrite(&this->N, sizeof(int), 1, pFile) == 1;
+	ok = ok && fwrite(&this->checkpoint_fingerprint, sizeof(unsigned int), 1, pFile) == 1;
+	ok = ok && fwrite(&iteration, sizeof(int), 1, pFile) == 1;
+	ok = ok && fwrite(&logPlast, sizeof(double), 1, pFile) == 1;
+	ok = ok && fwrite(&this->dlogP, sizeof(double), 1, pFile) == 1;
+	for (int iN=0; iN<this->N; iN++)
+	{
+		ok = ok && fwrite(this->A[iN], sizeof(double), this->N, pFile) == (size_t)this->N;
+	}
+	ok = ok && fwrite(this->proba, sizeof(double), this->N, pFile) == (size_t)this->N;
+	ok = ok && fwrite(&numdensities, sizeof(int), 1, pFile) == 1;
+	for (int iN=0; iN<numdensities; iN++)
+	{
+		int name = this->densityFunctions[iN]->get_name();
+		double mean = this->densityFunctions[iN]->get_mean();
+		double variance = this->densityFunctions[iN]->get_variance();
+		ok = ok && fwrite(&name, sizeof(int), 1, pFile) == 1;
+		ok = ok && fwrite(&mean, sizeof(double), 1, pFile) == 1;
+		ok = ok && fwrite(&variance, sizeof(double), 1, pFile) == 1;
+		if (name == ZERO_INFLATED_NEGATIVE_BINOMIAL)
+		{
+			double w = ((ZeroInflatedNegativeBinomial*) this->densityFunctions[iN])->get_w();
+			ok = ok && fwrite(&w, sizeof(double), 1, pFile) == 1;
+		}
+	}
+	ok = ok && fwrite(&nhistory, sizeof(int), 1, pFile) == 1;
+	if (nhistory > 0)
+	{
+		ok = ok && fwrite(&this->logP_history[0], sizeof(double), nhistory, pFile) == (size_t)nhistory;
+	}
+	ok = (fclose(pFile) == 0) && ok;
+	if (!ok)
+	{
+		//FILE_LOG(logWARNING) << "Could not write checkpoint file " << tmpfile;
+		Rprintf("Could not write checkpoint file %s\n", tmpfile.c_str());
+		remove(tmpfile.c_str());
+		return;
+	}
+
+	// rename() does not overwrite existing files on Windows
+	if (rename(tmpfile.c_str(), this->checkpoint_file.c_str()) != 0)
+	{
+		remove(this->checkpoint_file.c_str());
+		if (rename(tmpfile.c_str(), this->checkpoint_file.c_str()) != 0)
+		{
+			//FILE_LOG(logWARNING) << "Could not write checkpoint file " << this->checkpoint_file;
+			Rprintf("Could not write checkpoint file %s\n", this->checkpoint_file.c_str());
+		}
+	}
+}
+
+bool ScaleHMM::read_checkpoint(int* iteration, double* logPlast)
+{
+	//FILE_LOG(logDEBUG2) << __PRETTY_FUNCTION__;
+	if (this->checkpoint_file.empty()) return(false);
+	FILE* pFile = fopen(this->checkpoint_file.c_str(), "rb");
+	if (pFile == NULL) return(false);
+
+	// Read everything into temporary storage and only accept the checkpoint if it matches the current model and data
+	char magic[8];
+	int version, xvariate, T, N, iter, numdensities, nhistory;
+	unsigned int fingerprint;
+	double logPcheck, dlogPcheck;
+	bool ok = true;
+	ok = ok && fread(magic, sizeof(char), 8, pFile) == 8 && memcmp(magic, checkpoint_magic, 8) == 0;
+	ok = ok && fread(&version, sizeof(int), 1, pFile) == 1 && version == checkpoint_version;
+	ok = ok && fread(&xvariate, sizeof(int), 1, pFile) == 1 && xvariate == (int)this->xvariate;
+	ok = ok && fread(&T, sizeof(int), 1, pFile) == 1 && T == this->T;
+	ok = ok && fread(&N, sizeof(int), 1, pFile) == 1 && N == this->N;
+	ok = ok && fread(&fingerprint, sizeof(unsigned int), 1, pFile) == 1 && fingerprint == this->checkpoint_fingerprint;
+	ok = ok && fread(&iter, sizeof(int), 1, pFile) == 1 && iter >= 0;
+	ok = ok && fread(&logPcheck, sizeof(double), 1, pFile) == 1;
+	ok = ok && fread(&dlogPcheck, sizeof(double), 1, pFile) == 1;
+	std::vector<double> Acheck(this->N * this->N), probacheck(this->N);
+	ok = ok && fread(&Acheck[0], sizeof(double), this->N * this->N, pFile) == (size_t)(this->N * this->N);
+	ok = ok && fread(&probacheck[0], sizeof(double), this->N, pFile) == (size_t)this->N;
+	ok = ok && fread(&numdensities, sizeof(int), 1, pFile) == 1 && numdensities == (int)this->densityFunctions.size();
+	std::vector<double> means, variances, ws;
+	for (int iN=0; ok && iN<numdensities; iN++)
+	{
+		int name;
+		double mean, variance, w = 0;
+		ok = ok && fread(&name, sizeof(int), 1, pFile) == 1 && name == (int)this->densityFunctions[iN]->get_name();
+		ok = ok && fread(&mean, sizeof(double), 1, pFile) == 1;
+		ok = ok && fread(&variance, sizeof(double), 1, pFile) == 1;
+		if (ok && name == ZERO_INFLATED_NEGATIVE_BINOMIAL)
+		{
+			ok = fread(&w, sizeof(double), 1, pFile) == 1;
+		}
+		means.push_back(mean);
+		variances.push_back(variance);
+		ws.push_back(w);
+	}
+	ok = ok && fread(&nhistory, sizeof(int), 1, pFile) == 1 && nhistory >= 0;
+	std::vector<double> history(ok ? nhistory : 0);
+	if (ok && nhistory > 0)
+	{
+		ok = fread(&history[0], sizeof(double), nhistory, pFile) == (size_t)nhistory;
+	}
+	fclose(pFile);
+	if (!ok)
+	{
+		//FILE_LOG(logWARNING) << "Ignoring checkpoint " << this->checkpoint_file << " because it does not match the current model or data";
+		Rprintf("Ignoring checkpoint %s because it does not match the current model or data\n", this->checkpoint_file.c_str());
+		return(false);
+	}
+
+	// Restore the model state
+	for (int iN=0; iN<this->N; iN++)
+	{
+		for (int jN=0; jN<this->N; jN++)
+		{
+			this->A[iN][jN] = Acheck[iN*this->N + jN];
+		}
+		this->proba[iN] = probacheck[iN];
+	}
+	for (int iN=0; iN<numdensities; iN++)
+	{
+		if (this->densityFunctions[iN]->get_name() == ZERO_INFLATION) continue;
+		this->densityFunctions[iN]->set_mean(means[iN]);
+		this->densityFunctions[iN]->set_variance(variances[iN]);
+		if (this->densityFunctions[iN]->get_name() == ZERO_INFLATED_NEGATIVE_BINOMIAL)
+		{
+			((ZeroInflatedNegativeBinomial*) this->densityFunctions[iN])->set_w(ws[iN]);
+		}
+	}
+	this->logP = logPcheck;
+	this->dlogP = dlogPcheck;
+	this->logP_history = history;
+	*iteration = iter;
+	*logPlast = logPcheck;
+	return(true);
+}
@@ -6,11 +6,16 @@
 
 #include "utility.h"
 #include "densities.h"
+#include "hmmcore.h" // forward-backward recursions
 #include <cmath>
 #include <R.h> // R_CheckUserInterrupt()
 #include <vector> // storing density functions
 #include <time.h> // time(), difftime()
 #include <string> // strcmp
+#include <stdio.h> // fopen(), fwrite(), rename()
+#include <string.h> // memcmp()
+#include <exception> // exception_ptr
+#include <stdint.h> // uint8_t, uint16_t
 
 // #if defined TARGET_OS_MAC || defined __APPLE__
 // #include <libiomp/omp.h> // parallelization options on mac
@@ -28,29 +33,50 @@ class ScaleHMM  {
 
 		// Member variables
 		std::vector<Density*> densityFunctions; ///< density functions for each state
+		std::vector<std::vector<Density*> > marginals; ///< matrix [Nmod x number of univariate states] of marginal density functions of the copula, empty if the multivariate densities are given
 
 		// Methods
 		void initialize_transition_probs(double* initial_A, bool use_initial_params);
 		void initialize_proba(double* initial_proba, bool use_initial_params);
+		static void default_transition_probs(double* initial_A, int N); // the initial values if no initial parameters are given
+		static void default_proba(double* initial_proba, int N);
 		void baumWelch();
 		void EM(int* maxiter, int* maxtime, double* eps);
+		void onlineEM(int* O, int* chunk_lengths, int num_chunks, double decay, int* maxiter, int* maxtime, double* eps);
 		std::vector<double> calc_weights();
 		void calc_weights(double* weights);
+		void summarize_posteriors(int* ind_max, double* value_max, double* margin, double* entropy, double* sum_per_state, const int* counts);
 
 		// Getters and Setters
 		void get_posteriors(double** post);
+		void get_densities(double** dens, bool fused);
 		double get_posterior(int iN, int t);
 		double get_proba(int i);
 		double get_A(int i, int j);
 		double get_logP();
 		void set_cutoff(int cutoff);
+		void set_num_threads(int num_threads);
+		void set_quiet(bool quiet);
+		void set_engine(whichengine engine);
+		void set_checkpoint(const char* checkpoint_file, int checkpoint_interval, unsigned int fingerprint);
+		void set_observations(int* O, int T);
+		void set_segments(int* O, int* segment_lengths, int num_segments);
+		void set_copula(int** multi_O, int* comb_states, double* cor_matrix);
+		void get_cor_matrix(double* cor_matrix);
 
 	private:
 		// Member variables
 		int T; ///< length of observed sequence
+		int Tmax; ///< length for which memory was allocated, T can be reduced with set_observations()
+		int* obs; ///< vector [T] of observations, NULL if not set with set_observations()
+		int max_obs; ///< maximum of obs
+		std::vector<int> obs_values; ///< distinct values of obs in ascending order, empty if the observations are not encoded
+		std::vector<uint8_t> obs_codes8; ///< vector [T] of indices into obs_values if there are at most 256 distinct values
+		std::vector<uint16_t> obs_codes16; ///< vector [T] of indices into obs_values if there are at most 65536 distinct values
 		int N; ///< number of states
 		int Nmod; ///< number of modifications / marks
 		int cutoff; ///< a cutoff for observations
+		int num_threads; ///< number of threads of the parallel loops
 		double* sumgamma; ///< vector[N] of sum of posteriors (gamma values)
 		double** sumxi; ///< matrix[N x N] of xi values
 		double** gamma; ///< matrix[N x T] of posteriors
@@ -58,10 +84,24 @@ class ScaleHMM  {
 		double dlogP; ///< difference in loglikelihood from one iteration to the next
 		double** A; ///< matrix [N x N] of transition probabilities
 		double* proba; ///< initial probabilities (length N)
-		double* scalefactoralpha; ///< vector[T] of scaling factors
-		double** scalealpha; ///< matrix [T x N] of forward probabilities
-		double** scalebeta; ///<  matrix [T x N] of backward probabilities
-		double** densities; ///< matrix [N x T] of density values
+		whichengine engine; ///< numeric representation of the forward and backward variables, LOG_SPACE only for univariate HMMs over bins
+		ForwardBackwardBase* fb; ///< forward and backward variables and recursions for the engine
+		double** densities; ///< matrix [N x T] of density values, log-densities if the engine is LOG_SPACE
+		std::vector<int> densities_version; ///< vector[N] of density function versions for which densities[iN] was computed (-1 if never)
+		std::vector<int> num_zero_densities; ///< vector[T] of number of states with a computed density of zero
+		double** logdensities; ///< matrix [N x T] of log-densities, computed only if the densities of all states underflow to zero at some time point, NULL before
+		std::vector<int> segment_offsets; ///< vector[T+1] of start indices into segment_values and segment_counts, empty if the HMM runs over bins
+		std::vector<int> segment_values; ///< observed values that occur in each segment
+		std::vector<int> segment_counts; ///< number of bins in the segment with this value
+		std::vector<double> segment_logscale; ///< vector[T] of log-densities that were factored out of the segment densities
+		int segment_max_obs; ///< maximum observation over all segments
+		std::vector<int*> multi_obs; ///< vector [Nmod] of observations of each modification, empty if the multivariate densities are given
+		std::vector<int> comb_states; ///< matrix [Nmod x N] of the univariate state of each modification in each combined state
+		std::vector<double> cor_matrix; ///< array [Nmod x Nmod x N] of correlation matrices of the copula
+		std::vector<double> cor_matrix_inv; ///< array [Nmod x Nmod x N] of inverted correlation matrices
+		std::vector<double> cor_matrix_determinant; ///< vector [N] of determinants of the correlation matrices
+		std::vector<std::vector<std::vector<double> > > marginal_dens_per_read; ///< tables [Nmod x number of univariate states] of marginal densities for each observed value, shared by the copulas
+		std::vector<std::vector<std::vector<double> > > marginal_z_per_read; ///< tables [Nmod x number of univariate states] of z-values of the marginals for each observed value, shared by the copulas
 // 		double** tdensities; ///< matrix [T x N] of density values, for use in multivariate !increases speed, but on cost of RAM usage and that seems to be limiting
 		time_t EMStartTime_sec; ///< start time of the EM in sec
 		int EMTime_real; ///< elapsed time from start of the 0th iteration
@@ -69,6 +109,11 @@ class ScaleHMM  {
 		double sumdiff_posterior; ///< sum of the difference in posterior (gamma) values from one iteration to the next
 // 		bool use_tdens; ///< switch for using the tdensities in the calculations
 		whichvariate xvariate; ///< enum which stores if UNIVARIATE or MULTIVARIATE
+		std::vector<double> logP_history; ///< loglikelihood of each iteration, stored in checkpoints
+		std::string checkpoint_file; ///< file to which the model state is written during the EM (empty string for no checkpoints)
+		int checkpoint_interval; ///< number of iterations between two checkpoints
+		unsigned int checkpoint_fingerprint; ///< hash of the observations to prevent resuming from a checkpoint of different data
+		bool quiet; ///< no output to the console and no checks for user interrupts, set if the HMM runs in a worker thread
 
 		// Methods
 		void forward(); ///< calculate forward variables (alpha)
@@ -77,9 +122,24 @@ class ScaleHMM  {
 		void calc_sumxi();
 		void calc_loglikelihood();
 		void calc_densities();
+		void calc_logdensities(double** logdensities);
+		void update_densities_from_histogram(double** histogram, int max_obs);
+		void update_densities_from_histogram(std::vector<Density*>& densityFunctions, double** histogram, int max_obs);
+		void encode_observations();
+		void calc_histograms(double** histogram);
+		void calc_segment_densities();
+		void update_densities_from_segments();
+		void calc_copula_densities();
+		void update_copula();
+		void invert_cor_matrices();
+		void tabulate_marginals();
+		void update_copula_densityFunctions();
+		void check_user_interrupt();
 		void print_uni_iteration(int iteration);
 		void print_multi_iteration(int iteration);
 		void print_uni_params();
+		void write_checkpoint(int iteration, double logPlast, int nhistory);
+		bool read_checkpoint(int* iteration, double* logPlast);
 };
 
 #endif
@@ -0,0 +1,374 @@
+
+
+
+#include "specfun.h"
+#include <algorithm> // max()
+#include <cfloat> // DBL_MIN
+#include <cstring> // memcpy()
+#include <stdint.h> // int64_t
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// The recurrences accumulate rounding errors, so every this many steps the true function is evaluated again
+static const int anchor_interval = 64;
+
+// Tables are only ever added, older ones stay valid because densities keep pointers to them. A deque does not move its elements when it grows,
+// and the tables are freed with it when the library is unloaded.
+static std::mutex lxfactorial_mutex;
+static std::deque< std::vector<double> > lxfactorial_tables;
+static int lxfactorial_max_obs = -1;
+
+const double* lxfactorial_table(int max_obs)
+{
+	std::lock_guard<std::mutex> lock(lxfactorial_mutex);
+	if (max_obs > lxfactorial_max_obs)
+	{
+		// Grow at least by a factor of two to limit the number of tables
+		int n = std::max(max_obs, 2*lxfactorial_max_obs);
+		n = std::max(n, 1);
+		std::vector<double> table(n+1); // throws std::bad_alloc if there is no memory
+		table[0] = 0.0;
+		table[1] = 0.0;
+		for (int j=2; j<=n; j++)
+		{
+			table[j] = table[j-1] + log(j);
+		}
+		lxfactorial_tables.push_back(std::vector<double>());
+		lxfactorial_tables.back().swap(table);
+		lxfactorial_max_obs = n;
+	}
+	return &lxfactorial_tables.back()[0];
+}
+
+// For x<1 the first step cancels: digamma(x) and trigamma(x) are dominated by -1/x and 1/x^2, which the step removes again
+static inline bool is_anchor(double x, int j)
+{
+	return (j % anchor_interval == 0) || (j == 1 && x < 1);
+}
+
+void lgamma_table(double x, int n, double* table)
+{
+	// lgamma(x+1) = lgamma(x) + log(x)
+	for (int j=0; j<=n; j++)
+	{
+		if (j % anchor_interval == 0)
+		{
+			table[j] = lgamma(x+j);
+		}
+		else
+		{
+			table[j] = table[j-1] + log(x+j-1);
+		}
+	}
+}
+
+void digamma_table(double x, int n, double* table)
+{
+	// digamma(x+1) = digamma(x) + 1/x
+	for (int j=0; j<=n; j++)
+	{
+		if (is_anchor(x, j))
+		{
+			table[j] = digamma(x+j);
+		}
+		else
+		{
+			table[j] = table[j-1] + 1.0/(x+j-1);
+		}
+	}
+}
+
+void trigamma_table(double x, int n, double* table)
+{
+	// trigamma(x+1) = trigamma(x) - 1/x^2
+	for (int j=0; j<=n; j++)
+	{
+		if (is_anchor(x, j))
+		{
+			table[j] = trigamma(x+j);
+		}
+		else
+		{
+			table[j] = table[j-1] - 1.0/((x+j-1)*(x+j-1));
+		}
+	}
+}
+
+// Vectorizable kernels ---------------------------------------
+// Maximum errors compared to exp(), log(), lgamma(), digamma() and trigamma() for x in [1e-3,1e6], in units in the last place (ulp):
+//   exp_vec, log_vec: 1 ulp
+//   lgamma_vec: 54 ulp of max(1,|lgamma(x)|)
+//   digamma_vec: 9 ulp of max(1,|digamma(x)|)
+//   trigamma_vec: 55 ulp
+//   qnorm_vec: 8 ulp of max(1,|qnorm(p)|) for p in [DBL_MIN,1)
+// The kernels contain no branches, so arguments outside of their domain are recomputed afterwards with the library functions.
+
+// The asymptotic series are accurate for x>=shift, smaller arguments are shifted up with the recurrences
+static const int shift = 10;
+
+static inline double bits2double(int64_t bits)
+{
+	double x;
+	memcpy(&x, &bits, sizeof(double));
+	return x;
+}
+
+static inline int64_t double2bits(double x)
+{
+	int64_t bits;
+	memcpy(&bits, &x, sizeof(double));
+	return bits;
+}
+
+static inline double exp_kernel(double x)
+{
+	// exp(x) = 2^k * exp(r) with |r| <= log(2)/2, valid for |x| <= 708
+	const double ln2_hi = 6.93147180369123816490e-01;
+	const double ln2_lo = 1.90821492927058770002e-10;
+	const double round = 6755399441055744.0; // 1.5*2^52, adding it rounds to an integer in the lowest bits
+	double kr = x * 1.44269504088896338700 + round;
+	int64_t k = double2bits(kr) - double2bits(round);
+	double kd = kr - round;
+	double r = (x - kd * ln2_hi) - kd * ln2_lo;
+	// Taylor series up to r^13/13!
+	double p = 1.0/6227020800.0;
+	p = 1.0/479001600.0 + r*p;
+	p = 1.0/39916800.0 + r*p;
+	p = 1.0/3628800.0 + r*p;
+	p = 1.0/362880.0 + r*p;
+	p = 1.0/40320.0 + r*p;
+	p = 1.0/5040.0 + r*p;
+	p = 1.0/720.0 + r*p;
+	p = 1.0/120.0 + r*p;
+	p = 1.0/24.0 + r*p;
+	p = 1.0/6.0 + r*p;
+	p = 0.5 + r*p;
+	p = 1.0 + r*p;
+	p = 1.0 + r*p;
+	return p * bits2double((k + 1023) << 52);
+}
+
+static inline double log_kernel(double x)
+{
+	// log(x) = e*log(2) + log(m) with sqrt(2)/2 <= m < sqrt(2), valid for positive normal x (polynomial from fdlibm e_log.c)
+	const double ln2_hi = 6.93147180369123816490e-01;
+	const double ln2_lo = 1.90821492927058770002e-10;
+	const double Lg1 = 6.666666666666735130e-01;
+	const double Lg2 = 3.999999999940941908e-01;
+	const double Lg3 = 2.857142874366239149e-01;
+	const double Lg4 = 2.222219843214978396e-01;
+	const double Lg5 = 1.818357216161805012e-01;
+	const double Lg6 = 1.531383769920937332e-01;
+	const double Lg7 = 1.479819860511658591e-01;
+	int64_t bits = double2bits(x);
+	// Adding the difference between the bits of 1 and sqrt(2)/2 carries into the exponent exactly when m >= sqrt(2)
+	int64_t exponent = (bits + (0x3ff0000000000000LL - 0x3fe6a09e667f3bcdLL)) & 0x7ff0000000000000LL;
+	double m = bits2double(bits - exponent + 0x3ff0000000000000LL);
+	// The biased exponent is converted to double through the mantissa of 2^52
+	double e = bits2double(0x4330000000000000LL | (exponent >> 52)) - (4503599627370496.0 + 1023.0);
+	double f = m - 1.0;
+	double s = f / (2.0 + f);
+	double z = s * s;
+	double w = z * z;
+	double t1 = w * (Lg2 + w * (Lg4 + w * Lg6));
+	double t2 = z * (Lg1 + w * (Lg3 + w * (Lg5 + w * Lg7)));
+	double R = t2 + t1;
+	double hfsq = 0.5 * f * f;
+	return e * ln2_hi - ((hfsq - (s * (hfsq + R) + e * ln2_lo)) - f);
+}
+
+static inline double lgamma_kernel(double x)
+{
+	// lgamma(x) = lgamma(x+shift) - log(x*(x+1)*...*(x+shift-1))
+	double prod = x;
+	for (int j=1; j<shift; j++)
+	{
+		prod *= x + j;
+	}
+	double z = x + shift;
+	// Stirling series up to B16
+	double w = 1.0 / (z*z);
+	double series = -3617.0/122400.0;
+	series = 1.0/156.0 + w*series;
+	series = -691.0/360360.0 + w*series;
+	series = 1.0/1188.0 + w*series;
+	series = -1.0/1680.0 + w*series;
+	series = 1.0/1260.0 + w*series;
+	series = -1.0/360.0 + w*series;
+	series = 1.0/12.0 + w*series;
+	return (z - 0.5) * log_kernel(z) - z + 0.918938533204672741780329736406 + series / z - log_kernel(prod);
+}
+
+static inline double digamma_kernel(double x)
+{
+	// digamma(x) = digamma(x+shift) - 1/x - 1/(x+1) - ... - 1/(x+shift-1)
+	double sum = 0.0;
+	for (int j=0; j<shift; j++)
+	{
+		sum += 1.0 / (x + j);
+	}
+	double z = x + shift;
+	// Asymptotic series up to B16
+	double w = 1.0 / (z*z);
+	double series = -3617.0/8160.0;
+	series = 1.0/12.0 + w*series;
+	series = -691.0/32760.0 + w*series;
+	series = 1.0/132.0 + w*series;
+	series = -1.0/240.0 + w*series;
+	series = 1.0/252.0 + w*series;
+	series = -1.0/120.0 + w*series;
+	series = 1.0/12.0 + w*series;
+	return log_kernel(z) - 0.5 / z - w * series - sum;
+}
+
+static inline double trigamma_kernel(double x)
+{
+	// trigamma(x) = trigamma(x+shift) + 1/x^2 + 1/(x+1)^2 + ... + 1/(x+shift-1)^2
+	double sum = 0.0;
+	for (int j=0; j<shift; j++)
+	{
+		sum += 1.0 / ((x + j) * (x + j));
+	}
+	double z = x + shift;
+	// Asymptotic series up to B16
+	double w = 1.0 / (z*z);
+	double series = -3617.0/510.0;
+	series = 7.0/6.0 + w*series;
+	series = -691.0/2730.0 + w*series;
+	series = 5.0/66.0 + w*series;
+	series = -1.0/30.0 + w*series;
+	series = 1.0/42.0 + w*series;
+	series = -1.0/30.0 + w*series;
+	series = 1.0/6.0 + w*series;
+	return 1.0 / z + 0.5 * w + w / z * series + sum;
+}
+
+static inline double qnorm_kernel(double p)
+{
+	// Algorithm AS241 (Wichura 1988) as in R's qnorm(), with the central and both tail approximations always evaluated and the result selected afterwards
+	// The selection multiplies with weights of exactly 0 or 1 made by copysign(), because the compiler moves the approximations into branches for conditional expressions
+	// All denominators stay positive for p in (0,1), so the approximations that are not selected are finite
+	double q = p - 0.5;
+	double r = 0.180625 - q * q;
+	double central = q * (((((((r * 2509.0809287301226727 +
+		33430.575583588128105) * r + 67265.770927008700853) * r +
+		45921.953931549871457) * r + 13731.693765509461125) * r +
+		1971.5909503065514427) * r + 133.14166789178437745) * r +
+		3.387132872796366608)
+		/ (((((((r * 5226.495278852545925 +
+		28729.085735721942674) * r + 39307.89580009271061) * r +
+		21213.794301586595867) * r + 5394.1960214247511077) * r +
+		687.1870074920579083) * r + 42.313330701600911252) * r + 1.0);
+	// Distance into the nearer tail, from p if q<0 and from 1-p otherwise (both exact), with sqrt(x) = exp(log(x)/2) as sqrt() may set errno
+	double sign = copysign(1.0, q);
+	r = exp_kernel(0.5 * log_kernel(-log_kernel(0.5 * (1.0 + sign) - sign * p)));
+	double s = r - 1.6;
+	double near = (((((((s * 7.7454501427834140764e-4 +
+		0.0227238449892691845833) * s + 0.24178072517745061177) * s +
+		1.27045825245236838258) * s + 3.64784832476320460504) * s +
+		5.7694972214606914055) * s + 4.6303378461565452959) * s +
+		1.42343711074968357734)
+		/ (((((((s * 1.05075007164441684324e-9 +
+		5.475938084995344946e-4) * s + 0.0151986665636164571966) * s +
+		0.14810397642748007459) * s + 0.68976733498510000455) * s +
+		1.6763848301838038494) * s + 2.05319162663775882187) * s + 1.0);
+	s = r - 5.0;
+	double far = (((((((s * 2.01033439929228813265e-7 +
+		2.71155556874348757815e-5) * s + 0.0012426609473880784386) * s +
+		0.026532189526576123093) * s + 0.29656057182850489123) * s +
+		1.7848265399172913358) * s + 5.4637849111641143699) * s +
+		6.6579046435011037772)
+		/ (((((((s * 2.04426310338993978564e-15 +
+		1.4215117583164458887e-7) * s + 1.8463183175100546818e-5) * s +
+		7.868691311456132591e-4) * s + 0.0148753612908506148525) * s +
+		0.13692988092273580531) * s + 0.59983220655588793769) * s + 1.0);
+	double is_far = 0.5 - copysign(0.5, 5.0 - r); // 1 if r > 5
+	double is_central = 0.5 + copysign(0.5, 0.425 - fabs(q)); // 1 if |q| <= 0.425
+	double tail = sign * (is_far * far + (1.0 - is_far) * near);
+	return is_central * central + (1.0 - is_central) * tail;
+}
+
+static inline bool in_exp_domain(double x)
+{
+	return fabs(x) <= 708.0;
+}
+
+static inline bool in_log_domain(double x)
+{
+	return (x >= DBL_MIN) && (x <= DBL_MAX);
+}
+
+static inline bool in_gamma_domain(double x)
+{
+	// Positive normal x for which the product in lgamma_kernel() does not overflow
+	return (x >= DBL_MIN) && (x <= 1e30);
+}
+
+static inline bool in_qnorm_domain(double p)
+{
+	// Probabilities for which log_kernel() gets a positive normal argument
+	return (p >= DBL_MIN) && (p < 1.0);
+}
+
+static double exp_scalar(double x) { return exp(x); }
+static double log_scalar(double x) { return log(x); }
+static double lgamma_scalar(double x) { return lgamma(x); }
+static double digamma_scalar(double x) { return digamma(x); }
+static double trigamma_scalar(double x) { return trigamma(x); }
+static double qnorm_scalar(double p) { return qnorm(p, 0.0, 1.0, 1, 0); }
+
+// The arguments are copied in blocks, so that those outside of the domain of the kernel can be recomputed with the library function even if out and x are the same array
+template<double (*kernel)(double), double (*scalar)(double), bool (*in_domain)(double)>
+static void apply_kernel(const double* x, int n, double* out)
+{
+	const int block = 256;
+	double xblock[block];
+	for (int i0=0; i0<n; i0+=block)
+	{
+		int nblock = std::min(block, n-i0);
+		memcpy(xblock, x+i0, nblock * sizeof(double));
+		#pragma omp simd
+		for (int i=0; i<nblock; i++)
+		{
+			out[i0+i] = kernel(xblock[i]);
+		}
+		for (int i=0; i<nblock; i++)
+		{
+			if (!in_domain(xblock[i]))
+			{
+				out[i0+i] = scalar(xblock[i]);
+			}
+		}
+	}
+}
+
+void exp_vec(const double* x, int n, double* out)
+{
+	apply_kernel<exp_kernel, exp_scalar, in_exp_domain>(x, n, out);
+}
+
+void log_vec(const double* x, int n, double* out)
+{
+	apply_kernel<log_kernel, log_scalar, in_log_domain>(x, n, out);
+}
+
+void lgamma_vec(const double* x, int n, double* out)
+{
+	apply_kernel<lgamma_kernel, lgamma_scalar, in_gamma_domain>(x, n, out);
+}
+
+void digamma_vec(const double* x, int n, double* out)
+{
+	apply_kernel<digamma_kernel, digamma_scalar, in_gamma_domain>(x, n, out);
+}
+
+void trigamma_vec(const double* x, int n, double* out)
+{
+	apply_kernel<trigamma_kernel, trigamma_scalar, in_gamma_domain>(x, n, out);
+}
+
+void qnorm_vec(const double* p, int n, double* out)
+{
+	apply_kernel<qnorm_kernel, qnorm_scalar, in_qnorm_domain>(p, n, out);
+}
@@ -0,0 +1,26 @@
+
+
+
+#ifndef SPECFUN_H
+#define SPECFUN_H
+
+#include <cmath>
+#include <Rmath.h> // digamma(), trigamma(), qnorm()
+
+/* log-factorials log(j!) for j=0..max_obs, shared read-only by all callers and freed when the library is unloaded */
+const double* lxfactorial_table(int max_obs);
+
+/* tables of special functions at x, x+1, ..., x+n, computed with recurrences */
+void lgamma_table(double x, int n, double* table); // table[j] = lgamma(x+j)
+void digamma_table(double x, int n, double* table); // table[j] = digamma(x+j)
+void trigamma_table(double x, int n, double* table); // table[j] = trigamma(x+j)
+
+/* special functions out[i] = f(x[i]) for i=0..n-1 without branches or library calls in the loop, so that the compiler can vectorize them; out may be the same array as x */
+void exp_vec(const double* x, int n, double* out);
+void log_vec(const double* x, int n, double* out);
+void lgamma_vec(const double* x, int n, double* out);
+void digamma_vec(const double* x, int n, double* out);
+void trigamma_vec(const double* x, int n, double* out);
+void qnorm_vec(const double* p, int n, double* out); // quantiles of the standard normal distribution
+
+#endif // SPECFUN_H
@@ -2,6 +2,9 @@
 
 
 #include "utility.h"
+#include "specfun.h" // log_vec()
+#include <vector> // choleskyInverse(), summarizePosteriors()
+#include <cfloat> // DBL_EPSILON
 
 /* helpers for memory management */
 double** allocDoubleMatrix(int rows, int cols)
@@ -46,6 +49,33 @@ void FreeDoubleMatrix(double** matrix, int rows)
 	Free(matrix);
 }
 
+double** newDoubleMatrix(int rows, int cols)
+{
+	double** matrix = new double*[rows]();
+	try
+	{
+		for (int i=0; i<rows; i++)
+		{
+			matrix[i] = new double[cols]();
+		}
+	}
+	catch (...)
+	{
+		deleteDoubleMatrix(matrix, rows);
+		throw;
+	}
+	return(matrix);
+}
+
+void deleteDoubleMatrix(double** matrix, int rows)
+{
+	for (int i=0; i<rows; i++)
+	{
+		delete[] matrix[i];
+	}
+	delete[] matrix;
+}
+
 int** allocIntMatrix(int rows, int cols)
 {
 	int** matrix = (int**) calloc(rows, sizeof(int*));
@@ -185,6 +215,216 @@ int argIntMax(int *a, const int N)
 	return argmax;
 }
 
+unsigned int hashIntArray(int *a, int N)
+{
+	unsigned int hash = 2166136261u;
+	for(int i=0;i<N;i++)
+	{
+		unsigned int x = (unsigned int) a[i];
+		for(int b=0;b<4;b++)
+		{
+			hash ^= (x >> (8*b)) & 0xff;
+			hash *= 16777619u;
+		}
+	}
+	return hash;
+}
+
+bool choleskyInverse(double *a, int N, double *inverse, double *determinant)
+{
+	// a = L*L^T, then det(a) = prod(L[j][j])^2 and a^-1 = L^-T * L^-1, all matrices column-major [N x N]
+	std::vector<double> L(N*N, 0.0), Linv(N*N, 0.0);
+	*determinant = 1.0;
+	for(int j=0;j<N;j++)
+	{
+		double d = a[j*N+j];
+		for(int k=0;k<j;k++) d -= L[k*N+j] * L[k*N+j];
+		// Not positive definite, or so close to singular that solve() would refuse it
+		if(!(d > DBL_EPSILON * a[j*N+j])) return false;
+		L[j*N+j] = sqrt(d);
+		*determinant *= d;
+		for(int i=j+1;i<N;i++)
+		{
+			double x = a[j*N+i];
+			for(int k=0;k<j;k++) x -= L[k*N+i] * L[k*N+j];
+			L[j*N+i] = x / L[j*N+j];
+		}
+	}
+	for(int j=0;j<N;j++)
+	{
+		Linv[j*N+j] = 1.0 / L[j*N+j];
+		for(int i=j+1;i<N;i++)
+		{
+			double x = 0.0;
+			for(int k=j;k<i;k++) x -= L[k*N+i] * Linv[j*N+k];
+			Linv[j*N+i] = x / L[i*N+i];
+		}
+	}
+	for(int j=0;j<N;j++)
+	{
+		for(int i=0;i<N;i++)
+		{
+			double x = 0.0;
+			for(int k=std::max(i,j);k<N;k++) x += Linv[i*N+k] * Linv[j*N+k];
+			inverse[j*N+i] = x;
+		}
+	}
+	return true;
+}
+
+void updateComoments(const double *z, double weight, int N, double *sumweight, double *mean, double *comoment)
+{
+	// West's weighted version of Welford's recurrences, comoment is column-major [N x N]
+	// With d = z - mean before the update, z - mean after it is d * (1 - weight/sumweight), so no temporary vector is needed
+	if(weight == 0) return;
+	*sumweight += weight;
+	double factor = weight * (1 - weight / *sumweight);
+	for(int j=0;j<N;j++)
+	{
+		for(int i=0;i<N;i++)
+		{
+			comoment[j*N+i] += factor * (z[i] - mean[i]) * (z[j] - mean[j]);
+		}
+	}
+	for(int i=0;i<N;i++)
+	{
+		mean[i] += (z[i] - mean[i]) * weight / *sumweight;
+	}
+}
+
+static void identityCorrelation(double *cor_matrix, int N, double *inverse, double *determinant)
+{
+	for(int j=0;j<N;j++)
+	{
+		for(int i=0;i<N;i++)
+		{
+			cor_matrix[j*N+i] = (i == j) ? 1.0 : 0.0;
+			inverse[j*N+i] = cor_matrix[j*N+i];
+		}
+	}
+	*determinant = 1.0;
+}
+
+bool invertCorrelation(double *cor_matrix, int N, double *inverse, double *determinant)
+{
+	// A matrix with non-finite entries or one that is not positive definite is replaced by the identity, as solve() failed in the former R code
+	bool valid = true;
+	for(int i=0;i<N*N;i++)
+	{
+		if(!std::isfinite(cor_matrix[i])) valid = false;
+	}
+	if(valid)
+	{
+		valid = choleskyInverse(cor_matrix, N, inverse, determinant);
+	}
+	if(!valid)
+	{
+		identityCorrelation(cor_matrix, N, inverse, determinant);
+	}
+	return valid;
+}
+
+bool correlationInverse(const double *comoment, int N, double *cor_matrix, double *inverse, double *determinant)
+{
+	// A constant variable gives the identity as well, cor() returned NA for it
+	for(int j=0;j<N;j++)
+	{
+		if(!(comoment[j*N+j] > 0))
+		{
+			identityCorrelation(cor_matrix, N, inverse, determinant);
+			return false;
+		}
+	}
+	for(int j=0;j<N;j++)
+	{
+		for(int i=0;i<N;i++)
+		{
+			cor_matrix[j*N+i] = (i == j) ? 1.0 : comoment[j*N+i] / sqrt(comoment[i*N+i] * comoment[j*N+j]);
+		}
+	}
+	return invertCorrelation(cor_matrix, N, inverse, determinant);
+}
+
+void summarizePosteriors(double** posteriors, int N, int T, const int* counts, int* ind_max, double* value_max, double* margin, double* entropy, double* sum_per_state, int num_threads)
+{
+	// Bins are processed in blocks, and within a block state by state, so that the inner loops run over contiguous bins and vectorize
+	const int block = 512;
+	int num_blocks = (T + block - 1) / block;
+	std::vector<double> partial((size_t)num_blocks * N, 0.0);
+	#pragma omp parallel num_threads(num_threads)
+	{
+		std::vector<double> best(block), second(block), ent(block), logp(block);
+		std::vector<int> arg(block);
+		#pragma omp for schedule(static)
+		for (int b=0; b<num_blocks; b++)
+		{
+			int t0 = b * block;
+			int len = std::min(block, T - t0);
+			for (int k=0; k<len; k++)
+			{
+				best[k] = posteriors[0][t0+k];
+				second[k] = 0.0; // posteriors are >= 0, so this is the runner-up once all states are seen and the maximum if N=1
+				arg[k] = 0;
+				ent[k] = 0.0;
+			}
+			for (int iN=0; iN<N; iN++)
+			{
+				const double* p = &posteriors[iN][t0];
+				if (iN > 0)
+				{
+					// Strictly greater keeps the first of equal maxima, like max_element()
+					for (int k=0; k<len; k++)
+					{
+						bool gt = p[k] > best[k];
+						second[k] = gt ? best[k] : std::max(second[k], p[k]);
+						best[k] = gt ? p[k] : best[k];
+						arg[k] = gt ? iN : arg[k];
+					}
+				}
+				if (entropy != NULL)
+				{
+					log_vec(p, len, &logp[0]);
+					for (int k=0; k<len; k++)
+					{
+						ent[k] -= (p[k] > 0.0) ? p[k] * logp[k] : 0.0;
+					}
+				}
+				if (sum_per_state != NULL)
+				{
+					double sum = 0.0;
+					if (counts == NULL)
+					{
+						for (int k=0; k<len; k++) sum += p[k];
+					}
+					else
+					{
+						for (int k=0; k<len; k++) sum += p[k] * counts[t0+k];
+					}
+					partial[(size_t)b * N + iN] = sum;
+				}
+			}
+			for (int k=0; k<len; k++)
+			{
+				if (ind_max != NULL) ind_max[t0+k] = arg[k];
+				if (value_max != NULL) value_max[t0+k] = best[k];
+				if (margin != NULL) margin[t0+k] = best[k] - second[k];
+				if (entropy != NULL) entropy[t0+k] = ent[k];
+			}
+		}
+	}
+	// The partial sums are added in a fixed order, so that the result does not depend on the number of threads
+	if (sum_per_state != NULL)
+	{
+		for (int b=0; b<num_blocks; b++)
+		{
+			for (int iN=0; iN<N; iN++)
+			{
+				sum_per_state[iN] += partial[(size_t)b * N + iN];
+			}
+		}
+	}
+}
+
 double Max(double *a, int N)
 {
 	double maximum=a[0];
@@ -25,6 +25,8 @@ double** allocDoubleMatrix(int rows, int cols);
 void freeDoubleMatrix(double** matrix, int rows);
 double** CallocDoubleMatrix(int rows, int cols);
 void FreeDoubleMatrix(double** matrix, int rows);
+double** newDoubleMatrix(int rows, int cols); // throws std::bad_alloc instead of calling R, safe in threads
+void deleteDoubleMatrix(double** matrix, int rows);
 int** allocIntMatrix(int rows, int cols);
 void freeIntMatrix(int** matrix, int rows);
 int** CallocIntMatrix(int rows, int cols);
@@ -39,6 +41,12 @@ double Max(double *a, int N);
 int argMax(double *a, const int N); //return an index of the maximum (the first one if tight happens)
 int intMax(int *a, int N);
 int argIntMax(int *a, const int N);
+unsigned int hashIntArray(int *a, int N); //FNV-1a hash, used to recognize observation vectors
+bool choleskyInverse(double *a, int N, double *inverse, double *determinant); //inverse and determinant of a symmetric matrix, false if it is not positive definite
+void updateComoments(const double *z, double weight, int N, double *sumweight, double *mean, double *comoment); //weighted Welford update of the means and co-moments with one observation
+bool invertCorrelation(double *cor_matrix, int N, double *inverse, double *determinant); //inverse and determinant of a correlation matrix, false if it is replaced by the identity
+bool correlationInverse(const double *comoment, int N, double *cor_matrix, double *inverse, double *determinant); //correlation matrix from the co-moments with inverse and determinant, false if the identity is used instead
+void summarizePosteriors(double** posteriors, int N, int T, const int* counts, int* ind_max, double* value_max, double* margin, double* entropy, double* sum_per_state, int num_threads); //per bin the 0-based state of the maximum posterior, the maximum, its margin to the runner-up and the entropy, and the sums of posteriors[N][T] per state (weighted by counts if not NULL) added to sum_per_state; outputs may be NULL
 double MaxMatrix(double**, int N, int M);
 int MaxIntMatrix(int**, int N, int M);
 double MaxDoubleMatrix(double**, int N, int M);